@@ -107,6 +107,11 @@ void Configuration::init(const std::string &path, const std::string& entry)
       two2one_window_size_ = getInteger(entry + "/twotime2onetime_window_size");
     } catch (const std::exception& e){two2one_window_size_ = 1;}
 
+    // Largest |t1 - t2| of the two-time matrix, 0 for the full matrix. 
+    try {
+      twotime_max_delay_ = getInteger(entry + "/twotime_max_delay");
+    } catch (const std::exception& e){twotime_max_delay_ = 0;}
+
     frame_stride_ = getLong(entry + "/stride_frames");
     frame_average_ = getLong(entry + "/avg_frames");
 
@@ -198,6 +203,11 @@ void Configuration::BuildQMap() {
   this->m_validPixelMask = new short[this->xdim * this->ydim];
   m_sbin = new int[this->xdim * this->ydim];
 
+  for (int i = 0; i < (xdim*ydim); i++) {
+    m_validPixelMask[i] = 0;
+    m_sbin[i] = 0;
+  }
+
   std::map<int, std::set<int>> sbin_to_qbin;
 
   // Build mapping from q-bin to s-bins and from s-bins to pixels. 
@@ -292,6 +302,21 @@ void Configuration::BuildQMap() {
     }
   }
 
+  m_binTable.qbin_offsets.push_back(0);
+  m_binTable.sbin_offsets.push_back(0);
+
+  for (auto it = m_mapping.begin(); it != m_mapping.end(); it++) {
+    m_binTable.qbins.push_back(it->first);
+
+    for (auto it2 = it->second.begin(); it2 != it->second.end(); it2++) {
+      m_binTable.sbins.push_back(it2->first);
+      m_binTable.pixels.insert(m_binTable.pixels.end(), it2->second.begin(), it2->second.end());
+      m_binTable.sbin_offsets.push_back(m_binTable.pixels.size());
+    }
+
+    m_binTable.qbin_offsets.push_back(m_binTable.sbins.size());
+  }
+
   pixels_per_bin = new int[m_totalStaticPartitions];
   for (int i = 0; i < m_totalStaticPartitions; i++) {
     pixels_per_bin[i] = 0;
@@ -534,11 +559,16 @@ int Configuration::getFrameCount()
     return (frameEnd - frameStart) + 1;
 }
 
-std::map<int, std::map<int, std::vector<int>> > Configuration::getBinMaps()
+const std::map<int, std::map<int, std::vector<int>> >& Configuration::getBinMaps()
 {
     return this->m_mapping;
 }
 
+const BinTable& Configuration::getBinTable()
+{
+    return this->m_binTable;
+}
+
 int Configuration::getTotalStaticPartitions()
 {
     return this->m_totalStaticPartitions;
@@ -695,5 +725,10 @@ int Configuration::Two2OneWindowSize()
   return two2one_window_size_;
 }
 
+int Configuration::TwoTimeMaxDelay()
+{
+  return twotime_max_delay_;
+}
+
 }
 
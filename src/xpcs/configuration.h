@@ -56,6 +56,20 @@ POSSIBILITY OF SUCH DAMAGE.
 
 namespace xpcs  {
 
+/**
+ * Flat form of the q-bin -> s-bin -> pixels mapping. The s-bins of the 
+ * q-bin qbins[i] are sbins[qbin_offsets[i]] .. sbins[qbin_offsets[i+1] - 1],
+ * and the pixels of the s-bin sbins[j] are pixels[sbin_offsets[j]] .. 
+ * pixels[sbin_offsets[j+1] - 1]. Everything is in ascending bin order. 
+ */
+struct BinTable {
+  std::vector<int> qbins;
+  std::vector<int> qbin_offsets;
+  std::vector<int> sbins;
+  std::vector<int> sbin_offsets;
+  std::vector<int> pixels;
+};
+
 class Configuration  {
 
 public:    
@@ -85,7 +99,9 @@ public:
 
   void init(const std::string &path, const std::string &entry);
 
-  std::map<int, std::map<int, std::vector<int>> > getBinMaps();
+  const std::map<int, std::map<int, std::vector<int>> >& getBinMaps();
+
+  const BinTable& getBinTable();
 
   int getTotalStaticPartitions();
   int getTotalDynamicPartitions();
@@ -96,6 +112,7 @@ public:
   int FrameAverage();
 
   int Two2OneWindowSize();
+  int TwoTimeMaxDelay();
   
   std::string getFilename();
   std::string& getIMMFilePath();
@@ -157,6 +174,9 @@ private:
   // Map of dynamic bins to static bin to pixels.
   std::map<int, std::map<int, std::vector<int> >> m_mapping;
 
+  // Same mapping flattened, built once with the q-map. 
+  BinTable m_binTable;
+
   int xdim;
   int ydim;
   int frameStart;
@@ -169,6 +189,7 @@ private:
   int m_staticWindow;
   int delays_per_level_;
   int two2one_window_size_;
+  int twotime_max_delay_;
 
   int *pixels_per_bin;
   int *dqmap;
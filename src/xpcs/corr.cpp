@@ -47,6 +47,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "corr.h"
 
+#include <algorithm>
 #include <math.h>
 #include <vector>
 #include <stdio.h>
@@ -54,7 +55,10 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <omp.h>
 
+#include "spdlog/spdlog.h"
+
 #include "configuration.h"
+#include "g2_normalizer.h"
 #include "h5_result.h"
 
 #include "xpcs/data_structure/sparse_data.h"
@@ -77,6 +81,28 @@ using Eigen::RowMajor;
 using Eigen::Ref;
 using Eigen::Map;
 using Eigen::OuterStride;
+using Eigen::Matrix;
+using Eigen::Dynamic;
+
+// Pixels per chunk of the multi-tau scratch, see multiTau2. 
+static const int kNormalizeChunk = 16384;
+
+// Frames per band (rows) and per tile (columns) of the two-time matrix. 
+static const int kTwoTimeBand = 128;
+static const int kTwoTimeTile = 512;
+
+// Pixels per panel of the dense two-time kernel, and the nonzero density 
+// of a q-bin from which kTwoTimeAuto picks the dense kernel. 
+static const int kTwoTimePixelTile = 256;
+static const double kTwoTimeDenseDensity = 0.05;
+
+// A q-bin of the two-time analysis and the span of its pixels in the bin 
+// table. 
+struct TwoTimeBin {
+  int qbin;
+  const int *pixels;
+  int count;
+};
 
 void Corr::multiTau(const MatrixXf &pixelData, int pix) {
     Configuration* conf = Configuration::instance();
@@ -307,33 +333,95 @@ void Corr::multiTauVec(SparseRMatF& pixelData,
 
 }
 
-void Corr::multiTau2(data_structure::SparseData* data, float* G2s, float* IPs, float* IFs)
+void Corr::correlatePixels(data_structure::SparseData* data, 
+                           const int* pixels, 
+                           int count, 
+                           float* G2, 
+                           float* IP, 
+                           float* IF, 
+                           bool preserve, 
+                           G2Kernel kernel, 
+                           double* busy)
 {
     Configuration* conf = Configuration::instance();
-    int w = conf->getFrameWidth();
-    int h = conf->getFrameHeight();
     int frames = conf->getFrameTodoCount();
-    int pixels = w * h;
 
     int maxLevel = calculateLevelMax(frames, conf->DelaysPerLevel());
 
-    vector<int> validPixels = data->ValidPixels();
-
     vector<tuple<int,int> > delays_per_level = delaysPerLevel(frames, conf->DelaysPerLevel(), maxLevel);
 
     int pix = 355517;
 
-    #pragma omp parallel for default(none) schedule(dynamic) shared(validPixels, delays_per_level, frames, pixels, G2s, IFs, IPs, data)
-    for (int i = 0; i < validPixels.size(); i++)
+    int taus = delays_per_level.size();
+
+    // Work per pixel is roughly proportional to its nonzeros and varies by 
+    // orders of magnitude across the detector. Pixels are dispatched heaviest
+    // first, and consecutive light pixels are batched into work items of 
+    // about the same nonzero count so they do not cost one dispatch each. 
+    vector<int> order(count);
+    long total_nnz = 0;
+    for (int i = 0; i < count; i++) {
+        order[i] = i;
+        total_nnz += data->NonZeros(pixels[i]);
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return data->NonZeros(pixels[a]) > data->NonZeros(pixels[b]);
+    });
+
+    int threads = omp_get_max_threads();
+    long item_nnz = std::max(1L, total_nnz / (threads * 64L));
+
+    vector<int> items;
+    long acc = 0;
+    items.push_back(0);
+    for (int n = 0; n < count; n++) {
+        acc += data->NonZeros(pixels[order[n]]);
+        if (acc >= item_nnz || n == count - 1) {
+            items.push_back(n + 1);
+            acc = 0;
+        }
+    }
+
+    int item_count = items.size() - 1;
+
+    #pragma omp parallel default(none) shared(pixels, delays_per_level, frames, G2, IP, IF, data, taus, preserve, kernel, order, items, item_count, busy)
+    {
+    double t0 = omp_get_wtime();
+
+    // Per-thread copies of the row when the filtered data has to survive
+    // the level coarsening below. 
+    vector<int> scratch_indx;
+    vector<float> scratch_vals;
+
+    #pragma omp for schedule(dynamic) nowait
+    for (int item = 0; item < item_count; item++)
+    for (int n = items[item]; n < items[item+1]; n++)
     {
-        data_structure::Row *row = data->Pixel(validPixels.at(i));
+        int i = order[n];
+        data_structure::Row row = data->Pixel(pixels[i]);
+
+        if (preserve && row.size > 0) {
+            scratch_indx.assign(row.indxPtr, row.indxPtr + row.size);
+            scratch_vals.assign(row.valPtr, row.valPtr + row.size);
+            row = data_structure::Row(&scratch_indx[0], &scratch_vals[0], row.size);
+        }
+
+        float *g2 = G2 + (long)i * taus;
+        float *ip = IP + (long)i * taus;
+        float *iff = IF + (long)i * taus;
+
+        for (int t = 0; t < taus; t++) {
+            g2[t] = 0.0f;
+            ip[t] = 0.0f;
+            iff[t] = 0.0f;
+        }
 
         int ll = 0;
 
         int lastframe = frames;
-        int lastIndex = row->indxPtr.size();
+        int lastIndex = row.size;
         int tauIndex = 0;
-        int g2Index = 0;
         
         // if (validPixels.at(i) == pix) {
         //     printf("Last Index %d\n", lastIndex);
@@ -350,7 +438,7 @@ void Corr::multiTau2(data_structure::SparseData* data, float* G2s, float* IPs, f
             // int lastIndex;
 
             // if (level == 0)
-            //     lastIndex = row->indxPtr.size();
+            //     lastIndex = row.size;
 
             if (ll != level)
             {   
@@ -367,26 +455,26 @@ void Corr::multiTau2(data_structure::SparseData* data, float* G2s, float* IPs, f
                 int cnt = 0;
                 
                 int i0, i1;
-                i0 = row->indxPtr[cnt] / 2.0;
+                i0 = row.indxPtr[cnt] / 2.0;
 
                 if (lastIndex > 0 && i0 < lastframe) {
-                    row->indxPtr[index] = i0;
+                    row.indxPtr[index] = i0;
                     cnt = 1;
                 }
 
                 while (cnt < lastIndex) 
                 {
-                    i1 = row->indxPtr[cnt] / 2.0;
+                    i1 = row.indxPtr[cnt] / 2.0;
                     if (i1 >= lastframe) break;
 
                     if (i1 == i0) 
                     {
-                        row->valPtr[index] += row->valPtr[cnt]; 
+                        row.valPtr[index] += row.valPtr[cnt]; 
                     }
                     else 
                     {
-                        row->indxPtr[++index] = i1;
-                        row->valPtr[index] = row->valPtr[cnt];
+                        row.indxPtr[++index] = i1;
+                        row.valPtr[index] = row.valPtr[cnt];
                     }
 
                     i0 = i1;
@@ -396,32 +484,32 @@ void Corr::multiTau2(data_structure::SparseData* data, float* G2s, float* IPs, f
                 lastIndex = index+1;
 
                 for (int i = 0 ; i < lastIndex; i++) 
-                    row->valPtr[i] /= 2.0f;
+                    row.valPtr[i] /= 2.0f;
 
 
 
-                // if (row->indxPtr.size() == 1) {
-                //     row->indxPtr[index] = i0;
-                //     row->valPtr[index] = row->valPtr[index]/2.0f;
+                // if (row.size == 1) {
+                //     row.indxPtr[index] = i0;
+                //     row.valPtr[index] = row.valPtr[index]/2.0f;
                 // }
 
                 // int inc;
                 // while (i1 < lastframe && cnt < lastIndex-1)
                 // {   
-                //     i0 = row->indxPtr[cnt] / 2;
-                //     i1 = row->indxPtr[cnt+1] / 2;
+                //     i0 = row.indxPtr[cnt] / 2;
+                //     i1 = row.indxPtr[cnt+1] / 2;
                     
                 //     inc = 0;
                 //     if (i0 == i1)
                 //     {
-                //         row->indxPtr[index] = i0;
-                //         row->valPtr[index] = (row->valPtr[cnt] + row->valPtr[cnt+1]) / 2.0f;
+                //         row.indxPtr[index] = i0;
+                //         row.valPtr[index] = (row.valPtr[cnt] + row.valPtr[cnt+1]) / 2.0f;
                 //         inc = 2;
                 //     }
                 //     else
                 //     {
-                //         row->indxPtr[index] = i0;
-                //         row->valPtr[index] = row->valPtr[cnt] / 2.0f;
+                //         row.indxPtr[index] = i0;
+                //         row.valPtr[index] = row.valPtr[cnt] / 2.0f;
                 //         inc = 1;
                 //     }
 
@@ -433,8 +521,8 @@ void Corr::multiTau2(data_structure::SparseData* data, float* G2s, float* IPs, f
                 // // In case,we are left with one off element
                 // if (i0 != i1 && i1 < lastframe && cnt < lastIndex)
                 // {
-                //     row->indxPtr[index] = i1;
-                //     row->valPtr[index] = row->valPtr[cnt] / 2.0f;
+                //     row.indxPtr[index] = i1;
+                //     row.valPtr[index] = row.valPtr[cnt] / 2.0f;
                 //     index++;
                 // }
 
@@ -444,7 +532,7 @@ void Corr::multiTau2(data_structure::SparseData* data, float* G2s, float* IPs, f
                 // if (validPixels.at(i) == pix) {
                 //     printf("level = %d, lastframe = %d, lastIndex = %d\n", level, lastframe, lastIndex);
                 //     for (int ii = 0; ii < lastIndex; ii++) {
-                //         printf("%d -> %f\n", row->indxPtr[ii], row->valPtr[ii]);
+                //         printf("%d -> %f\n", row.indxPtr[ii], row.valPtr[ii]);
                 //     }
                 //     printf("\n");
                 // }
@@ -453,235 +541,509 @@ void Corr::multiTau2(data_structure::SparseData* data, float* G2s, float* IPs, f
             if (level > 0)
                 tau = tau / pow(2, level);
 
-            g2Index = tauIndex * pixels + validPixels[i]; // * delays_per_level.size() + tauIndex;
-    
             //if (level > 1)
              // printf("Level = %d, Tau = %d\n", level, tau);
 
+            // Partner of the merge kernel, the frame at or after src+tau.
+            int k = 0;
+
             for (int r = 0; r < lastIndex; r++)
             {
-                int src = row->indxPtr[r];
+                int src = row.indxPtr[r];
                 int dst = src;
                 
-                if (src < (lastframe-tau)) {
-                    IPs[g2Index] += row->valPtr[r];
+                if (src < (lastframe-tau) && kernel == kMergeKernel) {
+                    ip[tauIndex] += row.valPtr[r];
+
+                    // The row and its tau-shifted copy are both sorted, so
+                    // the partner only ever moves forward, O(nnz) per delay.
+                    while (k < lastIndex && row.indxPtr[k] < (src+tau))
+                        k++;
+
+                    if (k < lastIndex && row.indxPtr[k] == (src+tau))
+                        g2[tauIndex] += row.valPtr[r] * row.valPtr[k];
+                }
+                else if (src < (lastframe-tau)) {
+                    ip[tauIndex] += row.valPtr[r];
                     int limit = min(lastIndex, src+tau+1);
                     
                     for (int j = r+1; j < limit; j++)
                     {
-                        dst = row->indxPtr[j];
+                        dst = row.indxPtr[j];
                         if (dst == (src+tau)) {
-                            G2s[g2Index] += row->valPtr[r] * row->valPtr[j];
+                            g2[tauIndex] += row.valPtr[r] * row.valPtr[j];
                            // if (level > 1)
                             ///   printf("level=%d, src=%d dst=%d, tau=%d, (src+tau)=%d\n",level, src, dst, tau, (src+tau));
-                            //IFs[g2Index] += row->valPtr[j];
+                            //IFs[g2Index] += row.valPtr[j];
                         }
                     }
                 }
 
                 if (src >= tau && src < lastframe) {
                   //if (level > 1) printf("src >= tau %d\n", src);
-                  IFs[g2Index] += row->valPtr.at(r);
+                  iff[tauIndex] += row.valPtr[r];
                 }
 
             }
 
             if ( (lastframe - tau) > 0) {
-                G2s[g2Index] /= (lastframe-tau);
-                IPs[g2Index] /= (lastframe-tau);
-                IFs[g2Index] /= (lastframe-tau);
+                g2[tauIndex] /= (lastframe-tau);
+                ip[tauIndex] /= (lastframe-tau);
+                iff[tauIndex] /= (lastframe-tau);
             }
             
             ll = level;
             tauIndex++;
         }
     }
+
+    busy[omp_get_thread_num()] += omp_get_wtime() - t0;
+    }
 }
 
-void Corr::twotime(data_structure::SparseData *data)
+void Corr::multiTau2(data_structure::SparseData* data, float* G2s, float* IPs, float* IFs, bool preserve, G2Kernel kernel)
 {
-  Configuration* conf = Configuration::instance();
-  int frames = conf->getFrameTodoCount();
-  int wsize = conf->Two2OneWindowSize();
-  vector<int> qphi_bins_to_process = conf->TwoTimeQMask();
-  std::map<int, vector<int>> qbin_to_pixels;
-
-  std::map<int, std::map<int, vector<int>> > qbins = conf->getBinMaps();
-
-  // 1. Go over each qbin to sbin mapping
-  for (map<int, map<int, vector<int>> >::const_iterator it = qbins.begin(); 
-    it != qbins.end(); it++) {
-    int q = it->first;
-    map<int, vector<int> > values =  it->second;
-
-    // 2. For each qbin if that qbin is in 
-    if (std::find(qphi_bins_to_process.begin(), qphi_bins_to_process.end(), q) 
-                        != qphi_bins_to_process.end()) {
-      std::vector<int> plist;
-      for (map<int, vector<int>>::const_iterator it2 =  values.begin(); it2 != values.end(); it2++) {
-        int sbin = it2->first;
-
-        vector<int> pixels = it2->second;
-        for(vector<int>::const_iterator pind = pixels.begin(); pind != pixels.end(); pind++) {    
-          int p = *pind;
-          plist.push_back(p);
+    Configuration* conf = Configuration::instance();
+    int w = conf->getFrameWidth();
+    int h = conf->getFrameHeight();
+    int frames = conf->getFrameTodoCount();
+    int pixels = w * h;
+
+    int maxLevel = calculateLevelMax(frames, conf->DelaysPerLevel());
+
+    vector<int>& validPixels = data->ValidPixels();
+
+    vector<tuple<int,int> > delays_per_level = delaysPerLevel(frames, conf->DelaysPerLevel(), maxLevel);
+
+    int taus = delays_per_level.size();
+    int slots = validPixels.size();
+
+    // Accumulate pixel-major, all delays of a pixel are contiguous, so a 
+    // thread only touches its own pixels' cache lines. Pixels are done a 
+    // chunk at a time and scattered into the tauIndex * pixels + pixel 
+    // layout, so the scratch never grows past chunk * taus values. The 
+    // chunks are cut from the pixels sorted by nonzeros over the whole 
+    // detector, so each chunk holds pixels of similar cost and no chunk 
+    // ends on a long tail of the few heavy beam-center pixels. 
+    vector<int> order(validPixels);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return data->NonZeros(a) > data->NonZeros(b);
+    });
+
+    int chunk = std::min(slots, kNormalizeChunk);
+    float *g2pm = new float[(long)chunk * taus];
+    float *ippm = new float[(long)chunk * taus];
+    float *ifpm = new float[(long)chunk * taus];
+
+    int threads = omp_get_max_threads();
+    vector<double> busy(threads, 0.0);
+
+    for (int begin = 0; begin < slots; begin += chunk) {
+        int end = std::min(slots, begin + chunk);
+
+        correlatePixels(data, order.data() + begin, end - begin, g2pm, ippm, ifpm, preserve, kernel, &busy[0]);
+
+        #pragma omp parallel for default(none) shared(order, pixels, G2s, IPs, IFs, g2pm, ippm, ifpm, taus, begin, end)
+        for (int t = 0; t < taus; t++)
+        {
+            for (int i = begin; i < end; i++)
+            {
+                long src = (long)(i - begin) * taus + t;
+                long dst = (long)t * pixels + order[i];
+
+                G2s[dst] = g2pm[src];
+                IPs[dst] = ippm[src];
+                IFs[dst] = ifpm[src];
+            }
+        }
+    }
+
+    double busy_min = *std::min_element(busy.begin(), busy.end());
+    double busy_max = *std::max_element(busy.begin(), busy.end());
+    spdlog::get("console")->info("multiTau2 thread busy time min {0:.3f}s max {1:.3f}s over {2} threads", 
+                                 busy_min, busy_max, threads);
+    for (int t = 0; t < threads; t++)
+        spdlog::get("console")->debug("multiTau2 thread {0} busy {1:.3f}s", t, busy[t]);
+
+    delete [] g2pm;
+    delete [] ippm;
+    delete [] ifpm;
+}
+
+void Corr::multiTau2(data_structure::SparseData* data, G2Normalizer* normalizer, bool preserve, G2Kernel kernel)
+{
+    Configuration* conf = Configuration::instance();
+    int frames = conf->getFrameTodoCount();
+
+    int maxLevel = calculateLevelMax(frames, conf->DelaysPerLevel());
+
+    vector<tuple<int,int> > delays_per_level = delaysPerLevel(frames, conf->DelaysPerLevel(), maxLevel);
+
+    int taus = delays_per_level.size();
+
+    // Pixels are correlated a chunk at a time, in the order the normalizer 
+    // reduces them, so only chunk * taus per-pixel values are ever alive. 
+    const vector<int>& pixels = normalizer->Pixels();
+    int total = pixels.size();
+    int chunk = std::min(total, kNormalizeChunk);
+
+    // One extra row of zeros for the pixels without any data. 
+    float *g2pm = new float[(long)(chunk + 1) * taus];
+    float *ippm = new float[(long)(chunk + 1) * taus];
+    float *ifpm = new float[(long)(chunk + 1) * taus];
+
+    for (int t = 0; t < taus; t++) {
+        g2pm[(long)chunk * taus + t] = 0.0f;
+        ippm[(long)chunk * taus + t] = 0.0f;
+        ifpm[(long)chunk * taus + t] = 0.0f;
+    }
+
+    vector<int> work;
+    vector<int> slot(chunk);
+    int qbins = normalizer->QBins();
+
+    int threads = omp_get_max_threads();
+    vector<double> busy(threads, 0.0);
+
+    for (int begin = 0; begin < total; begin += chunk) {
+        int end = std::min(total, begin + chunk);
+
+        work.clear();
+        for (int p = begin; p < end; p++) {
+            if (data->NonZeros(pixels[p]) > 0) {
+                slot[p - begin] = work.size();
+                work.push_back(pixels[p]);
+            } else {
+                slot[p - begin] = chunk;
+            }
         }
 
-        qbin_to_pixels[q] = plist;
-      } 
+        correlatePixels(data, work.data(), work.size(), g2pm, ippm, ifpm, preserve, kernel, &busy[0]);
+
+        #pragma omp parallel for schedule(dynamic) default(none) shared(normalizer, qbins, begin, end, g2pm, ippm, ifpm, slot, taus)
+        for (int i = 0; i < qbins; i++) {
+            int b = std::max(begin, normalizer->QBinBegin(i));
+            int e = std::min(end, normalizer->QBinEnd(i));
+            if (b >= e) continue;
+
+            normalizer->Add(b, e, g2pm, ippm, ifpm, &slot[b - begin], taus, 1);
+        }
     }
+
+    double busy_min = *std::min_element(busy.begin(), busy.end());
+    double busy_max = *std::max_element(busy.begin(), busy.end());
+    spdlog::get("console")->info("multiTau2 thread busy time min {0:.3f}s max {1:.3f}s over {2} threads", 
+                                 busy_min, busy_max, threads);
+
+    delete [] g2pm;
+    delete [] ippm;
+    delete [] ifpm;
+}
+
+void Corr::twotime(data_structure::SparseData *data, TwoTimeKernel kernel)
+{
+  Configuration* conf = Configuration::instance();
+  int frames = conf->getFrameTodoCount();
+  int wsize = conf->Two2OneWindowSize();
+  const vector<int>& qphi_bins_to_process = conf->TwoTimeQMask();
+  const BinTable& table = conf->getBinTable();
+
+  // One work item per selected q-bin, its pixels are a span of the table. 
+  vector<TwoTimeBin> bins;
+  int qbins = table.qbins.size();
+  for (int i = 0; i < qbins; i++) {
+    if (std::find(qphi_bins_to_process.begin(), qphi_bins_to_process.end(), 
+                  table.qbins[i]) == qphi_bins_to_process.end())
+      continue;
+
+    int begin = table.sbin_offsets[table.qbin_offsets[i]];
+    int end = table.sbin_offsets[table.qbin_offsets[i + 1]];
+    if (table.qbin_offsets[i] == table.qbin_offsets[i + 1])
+      continue;
+
+    TwoTimeBin bin = { table.qbins[i], &table.pixels[begin], end - begin };
+    bins.push_back(bin);
   }
+  int nbins = bins.size();
 
-  float *sg = new float[qbin_to_pixels.size() * frames];
-  for (int i = 0; i < qbin_to_pixels.size() * frames; i++)
+  float *sg = new float[nbins * frames];
+  for (int i = 0; i < nbins * frames; i++)
     sg[i] = 0.0;
 
-  int q = 0;
-  for (auto it = qbin_to_pixels.begin(); it != qbin_to_pixels.end(); it++) {
-    int qbin = it->first;
-    vector<int> plist = it->second;
-    int pixels = plist.size();
+  for (int q = 0; q < nbins; q++) {
+    int pixels = bins[q].count;
     for (int i = 0; i < pixels; i++) {
-      data_structure::Row *row = data->Pixel(plist[i]);
-      std::vector<int> iptr = row->indxPtr;
-      std::vector<float>& vptr = row->valPtr;
-
-      for (int j = 0; j < iptr.size(); j++) {
-        int f = iptr[j];
-        float val = vptr[j];
-	//printf("q-bin = %d, frame = %d, pixel = %d, value=%f\n", q, f, plist[i], val);
-        sg[q * frames + f] += val;
+      data_structure::Row row = data->Pixel(bins[q].pixels[i]);
+      int *iptr = row.indxPtr;
+      float *vptr = row.valPtr;
+
+      for (int j = 0; j < row.size; j++) {
+        sg[q * frames + iptr[j]] += vptr[j];
       }       
     }
 
     for (int ff = 0 ; ff < frames; ff++) {
       sg[q * frames + ff] /= (float)pixels;
     }
-
-    q++;
   }
 
-  float **g2_pointers = new float*[qbin_to_pixels.size()];
-  float **g2full_pointers = new float*[qbin_to_pixels.size()];
+  float **g2full_pointers = new float*[bins.size()];
 
   int total_partials = (frames - wsize) / wsize;
-  float **g2partial_pointers = new float*[qbin_to_pixels.size()];
+  float **g2partial_pointers = new float*[bins.size()];
 
-  #pragma omp parallel for schedule(dynamic) 
-  for (int binIdx = 0; binIdx < qbin_to_pixels.size(); binIdx++) {
-    auto it = qbin_to_pixels.begin();
-    advance(it, binIdx);
+  // A positive twotime_max_delay limits the two-time matrix to the diagonal
+  // band t1 <= t2 <= t1 + max_delay, which must still cover the window of the 
+  // partials. The band is stored compactly as a frames x (max_delay + 1) 
+  // dataset under C2T_band, row t1 holding the delays 0 .. max_delay. 
+  int max_delay = conf->TwoTimeMaxDelay();
+  if (max_delay > 0 && max_delay < wsize - 1)
+    max_delay = wsize - 1;
 
-    int qbin = it->first;
-    vector<int> plist = it->second;
+  bool banded = max_delay > 0 && max_delay < frames - 1;
+  if (!banded)
+    max_delay = frames - 1;
 
-    float *g2 = new float[frames * frames];
-    float *g2full = new float[frames];
-    float *g2partial = new float[wsize * total_partials];
+  int delays = max_delay + 1;
 
-    for (int f = 0; f < frames*frames; f++)
-      g2[f] = 0.0f;
+  std::string c2t_path = conf->OutputPath() + (banded ? "/C2T_band/" : "/C2T_all/");
+
+  // Only the upper triangle (or its diagonal band) of the two-time matrix is 
+  // computed, a band of kTwoTimeBand frames (rows) at a time and within the 
+  // band a tile of kTwoTimeTile frames (columns) at a time. Every finished 
+  // band is written to its rows of the HDF5 dataset and folded into the 
+  // one-time results, so a thread never holds more than one band. 
+  #pragma omp parallel for schedule(dynamic) 
+  for (int binIdx = 0; binIdx < nbins; binIdx++) {
+    int qbin = bins[binIdx].qbin;
+    const int *plist = bins[binIdx].pixels;
+    int count = bins[binIdx].count;
+
+    // The rows are shared, so they are scaled by the mean frame intensity 
+    // of the q-bin as they are read. 
+    const float *sgq = sg + (long)binIdx * frames;
+
+    float *band = new float[(long)kTwoTimeBand * std::min(frames, kTwoTimeBand + max_delay)];
+    float *compact = banded ? new float[(long)kTwoTimeBand * delays] : NULL;
+    float *g2full = new float[delays];
+    float *g2partial = new float[wsize * total_partials];
 
     for (int f = 0; f < (wsize * total_partials); f++)
       g2partial[f] = 0.0f;
 
-    for (int f = 0; f < frames; f++)
+    for (int f = 0; f < delays; f++)
         g2full[f] = 0.0f;
 
-    for (int i = 0; i < plist.size(); i++) {
-      data_structure::Row *row = data->Pixel(plist[i]);
-      std::vector<int> iptr = row->indxPtr;
-      std::vector<float>& vptr = row->valPtr;
+    long nnz = 0;
+    int max_row = 0;
+    for (int i = 0; i < count; i++) {
+      int size = data->Pixel(plist[i]).size;
+      nnz += size;
+      max_row = std::max(max_row, size);
+    }
 
-      for (int j = 0; j < iptr.size(); j++) {
-        vptr[j] /= sg[binIdx * frames + iptr[j]];
-      }
+    // Fraction of the pixel x frame matrix of the q-bin that is nonzero. 
+    double density = count ? (double)nnz / ((double)count * frames) : 0.0;
+    bool dense = kernel == kTwoTimeDense || 
+                 (kernel == kTwoTimeAuto && density >= kTwoTimeDenseDensity);
+
+    spdlog::get("console")->debug("two-time q-bin {0} density {1:.4f}, {2} kernel", 
+                                  qbin, density, dense ? "dense" : "sparse");
+
+    // Frame x pixel panel of the dense kernel, rows a0 .. frames-1 are used.
+    MatrixXf panel;
+    if (dense)
+      panel.resize(frames, std::min(count, kTwoTimePixelTile));
+
+    // Scaled values of the rows (j) and columns (k) of a tile of the sparse 
+    // kernel.
+    vector<float> scaled0, scaledk;
+
+    // Per pixel of the sparse kernel the events of the current band of rows 
+    // (row_lo .. row_hi-1) and the first event of the current column tile. 
+    // The cursors only move forward, so every event is passed once per band
+    // and pixels without events in the band are left out of its tiles. 
+    vector<int> row_lo, row_hi, col_lo, active;
+    if (!dense) {
+      scaled0.resize(max_row);
+      scaledk.resize(max_row);
+      row_lo.resize(count);
+      row_hi.assign(count, 0);
+      col_lo.resize(count);
+      active.reserve(count);
     }
 
-    for (int i = 0; i < plist.size(); i++) {
-      data_structure::Row *row = data->Pixel(plist[i]);
-      std::vector<int> iptr = row->indxPtr;
-      std::vector<float> vptr = row->valPtr;
+    char buffer[100];
+    sprintf(buffer, "g2_%05d", qbin);
+    std::string g2_name(buffer);
 
-      for (int j = 0; j < iptr.size(); j++) {
-        
-        int f0 = iptr[j];
-        float val0 = vptr[j];
+    for (int a0 = 0; a0 < frames; a0 += kTwoTimeBand) {
+      int a1 = std::min(frames, a0 + kTwoTimeBand);
 
-        for (int k = j; k < iptr.size(); k++) {
-          int f1 = iptr[k];
-          float val1 = vptr[k];
-          g2[f0 * frames + f1] += val0 * val1;
-        }
-      }       
-    }
+      // Rows a0 .. a1-1 and columns a0 .. col_end-1 of the two-time matrix. 
+      int col_end = std::min(frames, a1 + max_delay);
+      int width = col_end - a0;
+      long band_size = (long)(a1 - a0) * width;
 
-    for (int ff = 0; ff < frames*frames; ff++) {
-        g2[ff] /= plist.size();
-    }
+      for (long f = 0; f < band_size; f++)
+        band[f] = 0.0f;
+
+      if (dense) {
+        Map<Matrix<float, Dynamic, Dynamic, RowMajor> > c2(band, a1 - a0, width);
+
+        for (int p0 = 0; p0 < count; p0 += panel.cols()) {
+          int p1 = std::min(count, p0 + (int)panel.cols());
 
-    for (int ff = 0; ff < frames; ff++) {
-        int count = 0;
-        int windowno = 0;
-        for (int fx = 0, fy = ff; fx < frames - ff; fx++, fy++) {
-            g2full[ff] += g2[fx*frames + fy];
+          panel.setZero();
+          for (int i = p0; i < p1; i++) {
+            data_structure::Row row = data->Pixel(plist[i]);
+            int *iptr = row.indxPtr;
+            float *vptr = row.valPtr;
 
+            for (int j = std::lower_bound(iptr, iptr + row.size, a0) - iptr; j < row.size; j++)
+              panel(iptr[j], i - p0) = vptr[j] / sgq[iptr[j]];
+          }
 
-            if (windowno < total_partials && ff < wsize) {
-              g2partial[ff * total_partials + windowno] += g2[fx*frames + fy];
+          // C2 rows a0 .. a1-1 against columns a0 .. col_end-1.
+          c2.noalias() += panel.middleRows(a0, a1 - a0) * panel.middleRows(a0, width).transpose();
+        }
+
+        // Only the upper triangle is part of the result. 
+        for (int r = 1; r < a1 - a0; r++)
+          for (int c = 0; c < r; c++)
+            c2(r, c) = 0.0f;
+      }
+
+      active.clear();
+      for (int i = 0; i < count && !dense; i++) {
+        data_structure::Row row = data->Pixel(plist[i]);
+        int jlo = row_hi[i];
+        int jhi = jlo;
+        while (jhi < row.size && row.indxPtr[jhi] < a1)
+          jhi++;
+
+        row_lo[i] = jlo;
+        row_hi[i] = jhi;
+        col_lo[i] = jlo;
+        if (jhi > jlo)
+          active.push_back(i);
+      }
+
+      for (int b0 = a0; b0 < col_end && !active.empty(); b0 += kTwoTimeTile) {
+        int b1 = std::min(col_end, b0 + kTwoTimeTile);
+
+        for (size_t n = 0; n < active.size(); n++) {
+          int i = active[n];
+          data_structure::Row row = data->Pixel(plist[i]);
+          const int *iptr = row.indxPtr;
+          const float *vptr = row.valPtr;
+
+          int jlo = row_lo[i];
+          int jhi = row_hi[i];
+          int klo = col_lo[i];
+          int khi = klo;
+          while (khi < row.size && iptr[khi] < b1)
+            khi++;
+          col_lo[i] = khi;
+
+          for (int j = jlo; j < jhi; j++)
+            scaled0[j - jlo] = vptr[j] / sgq[iptr[j]];
+
+          for (int k = klo; k < khi; k++)
+            scaledk[k - klo] = vptr[k] / sgq[iptr[k]];
+
+          for (int j = jlo; j < jhi; j++) {
+            int f0 = iptr[j];
+            float val0 = scaled0[j - jlo];
+            float *out = band + (long)(f0 - a0) * width;
+            int last = std::min(b1, f0 + delays);
+
+            for (int k = std::max(j, klo); k < khi && iptr[k] < last; k++) {
+              out[iptr[k] - a0] += val0 * scaledk[k - klo];
             }
-            
-            windowno = (fx+1) / wsize;
-            count++;
+          }
+        }
+      }
+
+      for (long f = 0; f < band_size; f++)
+        band[f] /= count;
+
+      if (banded) {
+        for (int r = 0; r < a1 - a0; r++) {
+          for (int d = 0; d < delays; d++) {
+            compact[(long)r * delays + d] = 
+                a0 + r + d < frames ? band[(long)r * width + r + d] : 0.0f;
+          }
         }
 
-        g2full[ff] /= count;
-    }
-    
-    g2full_pointers[binIdx] = g2full;
-    g2_pointers[binIdx] = g2;
+        #pragma omp critical(hdf5)
+        xpcs::H5Result::write2DBlock(conf->getFilename(), 
+                            c2t_path.c_str(), 
+                            g2_name.c_str(),
+                            frames, 
+                            delays, 
+                            a0,
+                            0,
+                            a1 - a0,
+                            delays,
+                            compact);
+      } else {
+        #pragma omp critical(hdf5)
+        xpcs::H5Result::write2DBlock(conf->getFilename(), 
+                            c2t_path.c_str(), 
+                            g2_name.c_str(),
+                            frames, 
+                            frames, 
+                            a0,
+                            a0,
+                            a1 - a0,
+                            width,
+                            band);
+      }
 
-    for (int f = 0; f < (wsize * total_partials); f++)
-      g2partial[f] /= wsize;
+      // One-time g2 along the diagonals, fx ascending like the full matrix.
+      for (int fx = a0; fx < a1; fx++) {
+        float *rowptr = band + (long)(fx - a0) * width + (fx - a0);
+        int windowno = fx / wsize;
 
-    g2partial_pointers[binIdx] = g2partial;
-  }
+        for (int ff = 0; ff < std::min(frames - fx, delays); ff++) {
+          g2full[ff] += rowptr[ff];
 
-  for (int i = 0; i < qbin_to_pixels.size(); i++) {
-    auto it = qbin_to_pixels.begin();
-    advance(it, i);
+          if (windowno < total_partials && ff < wsize) {
+            g2partial[ff * total_partials + windowno] += rowptr[ff];
+          }
+        }
+      }
+    }
 
-    int qbin = it->first;
+    for (int ff = 0; ff < delays; ff++) {
+        g2full[ff] /= (frames - ff);
+    }
 
-    float* ptrg2 = g2_pointers[i];
+    delete [] band;
+    delete [] compact;
 
-    char buffer[100];
-    sprintf(buffer, "g2_%05d", qbin);
-    std::string g2_name(buffer);
-    std::string path = conf->OutputPath() + "/C2T_all/";
+    g2full_pointers[binIdx] = g2full;
 
+    for (int f = 0; f < (wsize * total_partials); f++)
+      g2partial[f] /= wsize;
 
-    xpcs::H5Result::write2DData(conf->getFilename(), 
-                        path.c_str(), 
-                        g2_name.c_str(),
-                        frames, 
-                        frames, 
-                        ptrg2);
+    g2partial_pointers[binIdx] = g2partial;
   }
 
-  float* g2full_result = new float[qbin_to_pixels.size() * frames];
-  float* g2partial_result = new float[qbin_to_pixels.size() * wsize * total_partials];
+  float* g2full_result = new float[bins.size() * delays];
+  float* g2partial_result = new float[bins.size() * wsize * total_partials];
   
-  for (int j = 0; j < frames; j++) {
-    for (int i = 0; i < qbin_to_pixels.size(); i++) {
-        g2full_result[j * qbin_to_pixels.size() + i] = g2full_pointers[i][j];
+  for (int j = 0; j < delays; j++) {
+    for (int i = 0; i < nbins; i++) {
+        g2full_result[j * nbins + i] = g2full_pointers[i][j];
     }
   }
  
   int idd = 0;
   for (int i = 0; i < wsize; i++){
     for (int j = 0; j < total_partials; j++) {
-      for (int k = 0; k < qbin_to_pixels.size(); k++) {
+      for (int k = 0; k < nbins; k++) {
         g2partial_result[idd++] = g2partial_pointers[k][i*total_partials + j];
       }
     }
@@ -690,8 +1052,8 @@ void Corr::twotime(data_structure::SparseData *data)
   xpcs::H5Result::write2DData(conf->getFilename(), 
                         conf->OutputPath(), 
                         "g2full", 
-                        frames, 
-                        qbin_to_pixels.size(), 
+                        delays, 
+                        bins.size(), 
                         g2full_result);  
 
   xpcs::H5Result::write3DData(conf->getFilename(), 
@@ -699,185 +1061,39 @@ void Corr::twotime(data_structure::SparseData *data)
                         "g2partials", 
                         wsize, 
                         total_partials,
-                        qbin_to_pixels.size(),
+                        bins.size(),
                         g2partial_result);  
 
 
   xpcs::H5Result::write2DData(conf->getFilename(), 
                         conf->OutputPath(), 
                         "sg", 
-                        qbin_to_pixels.size(), 
+                        bins.size(), 
                         frames, 
                         sg);
 }
 
 //TODO: Refactor this function and possibly break into sub function for the unit-tests. 
-void Corr::normalizeG2s(Eigen::Ref<Eigen::MatrixXf> G2,
-                   Eigen::Ref<Eigen::MatrixXf> IP, 
-                   Eigen::Ref<Eigen::MatrixXf> IF)
+void Corr::normalizeG2s(const Eigen::Ref<const Eigen::MatrixXf>& G2,
+                   const Eigen::Ref<const Eigen::MatrixXf>& IP, 
+                   const Eigen::Ref<const Eigen::MatrixXf>& IF)
 {
-
-    Configuration* conf = Configuration::instance();
-    int w = conf->getFrameWidth();
-    int h = conf->getFrameHeight();
-
-    std::map<int, std::map<int, vector<int>> > qbins = conf->getBinMaps();
-
-    int totalStaticPartns = conf->getTotalStaticPartitions();
-    int totalDynamicPartns = conf->getTotalDynamicPartitions();
-
-    // Final result out of this function. 
-    MatrixXf g2(qbins.size(), G2.cols());
-    MatrixXf stdError(qbins.size(), G2.cols());
-
-    g2.setZero(g2.rows(), g2.cols());
-    stdError.setZero(stdError.rows(), stdError.cols());
-
-    // A matrix of the form total_static partitions over tau values.
-    // Each row is a static partition and column is different tau value.  
-    MatrixXf g2Sums(totalStaticPartns, G2.cols());
-    MatrixXf ipSums(totalStaticPartns, G2.cols());
-    MatrixXf ifSums(totalStaticPartns, G2.cols());
-
-    g2Sums.setZero(g2Sums.rows(), g2Sums.cols());
-    ipSums.setZero(ipSums.rows(), ipSums.cols());
-    ifSums.setZero(ifSums.rows(), ifSums.cols());
-
-    // Count of pixels for each static partition
-    VectorXi partitionPixelCounts(totalStaticPartns);
-    partitionPixelCounts.setZero(totalStaticPartns);
-
-    float sum = 0.0;
-    float sum2 = 0.0;
-
-    // Sum pixels for each static partitions. 
-    for (map<int, map<int, vector<int>> >::const_iterator it = qbins.begin(); 
-            it != qbins.end(); it++) {
-
-        int q = it->first;
-        map<int, vector<int> > values =  it->second;
-        
-        for (map<int, vector<int>>::const_iterator it2 =  values.begin(); it2 != values.end(); it2++) {
-            int sbin = it2->first;
-            
-            vector<int> pixels = it2->second;
-            for(vector<int>::const_iterator pind = pixels.begin(); pind != pixels.end(); pind++) {
-                int p = *pind;
-                
-                g2Sums.row(sbin - 1) += G2.row(p);
-                ipSums.row(sbin - 1) += IP.row(p);
-                ifSums.row(sbin - 1) += IF.row(p);
-
-                if ( (sbin-1) == 0 ) {
-                    sum += IP(p, 0);
-                    sum2 += IP(p, 1);
-                }
-
-                partitionPixelCounts(sbin-1) += 1;
-            }
-        }
-    }
-
-    // Compute averag of each static parition
-    VectorXi sbinCounts(totalDynamicPartns);
-    sbinCounts.setZero(totalDynamicPartns);
-
-    for (map<int, map<int, vector<int>> >::const_iterator it = qbins.begin(); 
-            it != qbins.end(); it++) {
-
-        int q = it->first;
-        map<int, vector<int> > values =  it->second;
-
-        for (map<int, vector<int>>::const_iterator it2 =  values.begin(); it2 != values.end(); it2++) {
-            int sbin = it2->first;
-
-            g2Sums.row(sbin-1).array() /= partitionPixelCounts(sbin-1);
-            ipSums.row(sbin-1).array() /= partitionPixelCounts(sbin-1);
-            ifSums.row(sbin-1).array() /= partitionPixelCounts(sbin-1);
-
-            // Normalize per bin static partition.
-
-            g2Sums.row(sbin-1) = g2Sums.row(sbin-1).array() / (ipSums.row(sbin-1).array() * ifSums.row(sbin-1).array());
-        }
+    G2Normalizer normalizer(G2.cols());
+
+    // Column-major, the values of pixel p are p, p + stride, ... Each q-bin 
+    // is an independent reduction. 
+    const int* pixels = normalizer.Pixels().data();
+    int qbins = normalizer.QBins();
+    long stride = G2.outerStride();
+
+    #pragma omp parallel for schedule(dynamic) default(none) shared(normalizer, pixels, qbins, stride, G2, IP, IF)
+    for (int i = 0; i < qbins; i++) {
+        int begin = normalizer.QBinBegin(i);
+        int end = normalizer.QBinEnd(i);
+        normalizer.Add(begin, end, G2.data(), IP.data(), IF.data(), pixels + begin, 1, stride);
     }
 
-    // // Compute the mean of normalized g2 values per dynamic bin.
-    VectorXf incrs(g2Sums.cols());
-    incrs.setOnes();
-    VectorXf counts(g2Sums.cols());
-
-    for (map<int, map<int, vector<int>> >::const_iterator it = qbins.begin(); 
-            it != qbins.end(); it++) {
-
-        int q = it->first;
-        map<int, vector<int> > values =  it->second;
-  
-        //int count = 0;
-        counts.setZero();
-
-        for (map<int, vector<int>>::const_iterator it2 =  values.begin(); it2 != values.end(); it2++) {
-            int sbin = it2->first;
-            VectorXf g2sum = g2Sums.row(sbin-1);
-            g2.row(q - 1) += Eigen::isnan(g2sum.array()).select(0.0, g2sum);
-            counts += Eigen::isnan(g2sum.array()).select(0.0, incrs); 
-        }
-
-        // Mean of each G2 across tau values. This is our final g2 Matrix. 
-        g2.row(q - 1).array() = g2.row(q - 1).array() / counts.array();
-    }
-
-    // Compute the standard error.
-    for (map<int, map<int, vector<int>> >::const_iterator it = qbins.begin(); 
-            it != qbins.end(); it++) {
-
-        int q = it->first;
-        map<int, vector<int> > values =  it->second;
-
-        VectorXf avgG2(G2.cols());
-        avgG2.setZero();
-        VectorXf tmpAvg(G2.cols());
-        tmpAvg.setZero();
-        VectorXf stdG2(G2.cols());
-        stdG2.setZero();
-        VectorXf samples(G2.cols());
-        samples.setZero();
-        VectorXf incrs(G2.cols());
-        incrs.setOnes();
-
-        for (map<int, vector<int>>::const_iterator it2 =  values.begin(); it2 != values.end(); it2++) {
-            int sbin = it2->first;
-
-            vector<int> pixels = it2->second;
-            for(vector<int>::const_iterator pind = pixels.begin(); pind != pixels.end(); pind++) {
-                int p = *pind;
-                tmpAvg = avgG2;
-
-                VectorXf normalizedG2 =  G2.row(p).array() / (IP.row(p).array() * IF.row(p).array());
-                samples += incrs;
-                normalizedG2 = Eigen::isnan(normalizedG2.array()).select(0, normalizedG2);
-                samples += Eigen::isnan(normalizedG2.array()).select(0, incrs);
-
-                VectorXf tmp0 = (normalizedG2 - tmpAvg);
-                VectorXf tmp00 = tmp0.array() / samples.array();
-                tmp00 = Eigen::isnan(tmp00.array()).select(0, tmp00);
-                avgG2 += tmp00;
-                VectorXf tmp1 = (normalizedG2 - tmpAvg);
-                VectorXf tmp2 = (normalizedG2 - avgG2);
-                VectorXf tmp3 = tmp1.array() * tmp2.array();
-
-                stdG2 += tmp3;
-            }
-        }
-
-        VectorXf stdNorm = stdG2.array() / samples.array();
-        samples = 1.0f / samples.array();
-        // std::cout<<samples.array().sqrt()<<std::endl;
-        stdError.row(q - 1).array() = samples.array().sqrt() * stdNorm.array().sqrt();
-    }
-
-    H5Result::write2DData(conf->getFilename(), conf->OutputPath(), "norm-0-g2", g2);
-    H5Result::write2DData(conf->getFilename(), conf->OutputPath(), "norm-0-stderr", stdError);
-
+    normalizer.Write();
 }
 
 double* Corr::computeG2Levels(const Eigen::MatrixXf &pixelData, 
@@ -59,6 +59,8 @@ namespace data_structure {
   class SparseData;
 }
 
+class G2Normalizer;
+
 typedef Eigen::SparseMatrix<float> SparseMatF;
 typedef Eigen::SparseMatrix<float, Eigen::RowMajor> SparseRMatF;
 
@@ -66,6 +68,21 @@ typedef Eigen::SparseMatrix<float, Eigen::RowMajor> SparseRMatF;
 class Corr  {
 
 public:
+
+  /**
+   * Pair search used by multiTau2 to find the frame src+tau of a pixel. 
+   * kScanKernel scans forward from every nonzero, O(nnz * tau) per delay,
+   * kMergeKernel walks the row and its tau-shifted copy together, O(nnz).
+   */
+  enum G2Kernel { kScanKernel, kMergeKernel };
+
+  /**
+   * Two-time C2 kernel. kTwoTimeSparse accumulates the outer products of the
+   * nonzeros of every pixel, kTwoTimeDense multiplies dense frame x pixel 
+   * panels with Eigen, kTwoTimeAuto picks per q-bin by nonzero density. 
+   */
+  enum TwoTimeKernel { kTwoTimeSparse, kTwoTimeDense, kTwoTimeAuto };
+
   static int calculateDelayCount(int dpl, int level);
 
   static int calculateLevelMax(int frameCount, int dpl);
@@ -95,13 +112,36 @@ public:
                           Eigen::Ref<Eigen::MatrixXf> IP, 
                           Eigen::Ref<Eigen::MatrixXf> IF);
 
-  static void multiTau2(data_structure::SparseData *data, float* G2, float* IP, float* IF);
+  /**
+   * Compute G2, IP and IF from the filtered sparse data. The multi-tau levels
+   * are coarsened in place unless preserve is set, in which case each thread
+   * works on a scratch copy of the row and the data stays usable afterwards.
+   */
+  static void multiTau2(data_structure::SparseData *data, 
+                        float* G2, 
+                        float* IP, 
+                        float* IF, 
+                        bool preserve = false,
+                        G2Kernel kernel = kMergeKernel);
 
-  static void twotime(data_structure::SparseData *data);
+  /**
+   * Compute G2, IP and IF a chunk of pixels at a time and reduce them 
+   * straight into the normalizer, without the pixels x taus arrays. 
+   */
+  static void multiTau2(data_structure::SparseData *data, 
+                        G2Normalizer* normalizer,
+                        bool preserve = false,
+                        G2Kernel kernel = kMergeKernel);
+
+  static void twotime(data_structure::SparseData *data, TwoTimeKernel kernel = kTwoTimeAuto);
 
-  static void normalizeG2s(Eigen::Ref<Eigen::MatrixXf> g2,
-                    Eigen::Ref<Eigen::MatrixXf> IP, 
-                    Eigen::Ref<Eigen::MatrixXf> IF);
+  /**
+   * Normalize per-pixel G2 by IP and IF over the static partitions. The 
+   * inputs are only read, Maps of the multi-tau buffers bind without copies.
+   */
+  static void normalizeG2s(const Eigen::Ref<const Eigen::MatrixXf>& g2,
+                    const Eigen::Ref<const Eigen::MatrixXf>& IP, 
+                    const Eigen::Ref<const Eigen::MatrixXf>& IF);
 
   static double* computeG2Levels(const Eigen::MatrixXf &pixelData, 
                               int pixel,
@@ -109,6 +149,22 @@ public:
                               int tau, 
                               int level);
 
+private:
+
+  /**
+   * Multi-tau of the given pixels, the delays of pixels[i] are written at 
+   * G2 + i * taus. The time each thread spent working is added to busy. 
+   */
+  static void correlatePixels(data_structure::SparseData *data, 
+                              const int* pixels, 
+                              int count, 
+                              float* G2, 
+                              float* IP, 
+                              float* IF, 
+                              bool preserve, 
+                              G2Kernel kernel, 
+                              double* busy);
+
 };
 
 } //namespace xpcs
@@ -0,0 +1,223 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+#include "corr_stream.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+
+#include "corr.h"
+#include "configuration.h"
+
+namespace xpcs {
+
+using std::vector;
+using std::tuple;
+using std::get;
+
+CorrStream::CorrStream(float* G2s, float* IPs, float* IFs) :
+    g2s_(G2s), ips_(IPs), ifs_(IFs)
+{
+    Configuration* conf = Configuration::instance();
+    int frames = conf->getFrameTodoCount();
+    int dpl = conf->DelaysPerLevel();
+    pixels_ = conf->getFrameWidth() * conf->getFrameHeight();
+
+    int maxLevel = Corr::calculateLevelMax(frames, dpl);
+    vector<tuple<int,int> > delays_per_level = Corr::delaysPerLevel(frames, dpl, maxLevel);
+
+    int taus = delays_per_level.size();
+
+    levels_ = 0;
+    for (int i = 0; i < taus; i++)
+        levels_ = std::max(levels_, get<0>(delays_per_level[i]) + 1);
+
+    level_delays_.resize(levels_);
+    for (int i = 0; i < taus; i++) {
+        int level = get<0>(delays_per_level[i]);
+        int tau = get<1>(delays_per_level[i]) / (int) pow(2, level);
+        level_delays_[level].push_back(std::make_tuple(i, tau));
+    }
+
+    // Same frame count reduction as multiTau2 does on level change. 
+    int lastframe = frames;
+    for (int l = 0; l < levels_; l++) {
+        level_frames_.push_back(lastframe);
+        lastframe = lastframe / 2;
+    }
+
+    // Longest delay is 2 * dpl at level 0 and dpl + dpl at every other level. 
+    register_size_ = 2 * dpl;
+
+    short* mask = conf->getPixelMask();
+    slots_ = new int[pixels_];
+    int slots = 0;
+    for (int i = 0; i < pixels_; i++)
+        slots_[i] = mask[i] != 0 ? slots++ : -1;
+
+    long states = (long) slots * levels_;
+    registers_ = new float[states * register_size_];
+    last_frame_ = new int[states];
+    pending_value_ = new float[states];
+    pending_frame_ = new int[states];
+
+    for (long i = 0; i < states; i++) {
+        last_frame_[i] = -1;
+        pending_frame_[i] = -1;
+        pending_value_[i] = 0.0f;
+    }
+}
+
+CorrStream::~CorrStream()
+{
+    delete [] slots_;
+    delete [] registers_;
+    delete [] last_frame_;
+    delete [] pending_value_;
+    delete [] pending_frame_;
+}
+
+void CorrStream::Append(int pixel, int frame, float value)
+{
+    int slot = slots_[pixel];
+    if (slot < 0 || levels_ == 0) return;
+
+    Push(slot, pixel, 0, frame, value);
+}
+
+void CorrStream::Push(int slot, int pixel, int level, int frame, float value)
+{
+    if (frame >= level_frames_[level]) return;
+
+    long state = (long) slot * levels_ + level;
+    float* reg = registers_ + state * register_size_;
+    int last = last_frame_[state];
+
+    // Frames skipped since the last value of this pixel were zeros. 
+    int gap = std::min(frame - last - 1, register_size_);
+    for (int f = frame - gap; f < frame; f++)
+        reg[f % register_size_] = 0.0f;
+
+    int lastframe = level_frames_[level];
+    vector<tuple<int, int> >& delays = level_delays_[level];
+
+    for (size_t d = 0; d < delays.size(); d++) {
+        int tau = get<1>(delays[d]);
+        long g2Index = (long) get<0>(delays[d]) * pixels_ + pixel;
+
+        if (frame < (lastframe - tau))
+            ips_[g2Index] += value;
+
+        if (frame >= tau) {
+            ifs_[g2Index] += value;
+            g2s_[g2Index] += reg[(frame - tau) % register_size_] * value;
+        }
+    }
+
+    reg[frame % register_size_] = value;
+    last_frame_[state] = frame;
+
+    if (level + 1 >= levels_) return;
+
+    // Average pairs of frames into the next level. 
+    int pframe = pending_frame_[state];
+    float pvalue = pending_value_[state];
+
+    if (pframe >= 0 && pframe / 2 == frame / 2) {
+        pending_frame_[state] = -1;
+        Push(slot, pixel, level + 1, frame / 2, (pvalue + value) / 2.0f);
+        return;
+    }
+
+    if (pframe >= 0) {
+        pending_frame_[state] = -1;
+        Push(slot, pixel, level + 1, pframe / 2, pvalue / 2.0f);
+    }
+
+    if (frame % 2 == 0) {
+        pending_frame_[state] = frame;
+        pending_value_[state] = value;
+    } else {
+        Push(slot, pixel, level + 1, frame / 2, value / 2.0f);
+    }
+}
+
+void CorrStream::Finish()
+{
+    for (int pixel = 0; pixel < pixels_; pixel++) {
+        int slot = slots_[pixel];
+        if (slot < 0) continue;
+
+        for (int level = 0; level + 1 < levels_; level++) {
+            long state = (long) slot * levels_ + level;
+            if (pending_frame_[state] < 0) continue;
+
+            int pframe = pending_frame_[state];
+            pending_frame_[state] = -1;
+            Push(slot, pixel, level + 1, pframe / 2, pending_value_[state] / 2.0f);
+        }
+    }
+
+    for (int level = 0; level < levels_; level++) {
+        vector<tuple<int, int> >& delays = level_delays_[level];
+        int lastframe = level_frames_[level];
+
+        for (size_t d = 0; d < delays.size(); d++) {
+            int tau = get<1>(delays[d]);
+            if ((lastframe - tau) <= 0) continue;
+
+            long offset = (long) get<0>(delays[d]) * pixels_;
+            for (int pixel = 0; pixel < pixels_; pixel++) {
+                g2s_[offset + pixel] /= (lastframe - tau);
+                ips_[offset + pixel] /= (lastframe - tau);
+                ifs_[offset + pixel] /= (lastframe - tau);
+            }
+        }
+    }
+}
+
+} // namespace xpcs
@@ -0,0 +1,109 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+#ifndef XPCS_CORR_STREAM_H
+#define XPCS_CORR_STREAM_H
+
+#include <vector>
+#include <tuple>
+
+namespace xpcs {
+
+/**
+ * Incremental multi-tau correlator. Filters feed the non-zero value of each 
+ * pixel frame by frame and the G2, IP and IF sums are accumulated on the fly. 
+ * Every pixel keeps one register of the last 2 * delays_per_level values for
+ * each level and the pending half of the next 2^level average, so memory
+ * scales with pixels x levels and not with the number of frames. 
+ * 
+ * The results are identical to Corr::multiTau2 and are written in the same 
+ * layout (tauIndex * pixels + pixel).
+ */
+class CorrStream {
+
+public:
+  CorrStream(float* G2s, float* IPs, float* IFs);
+
+  ~CorrStream();
+
+  // Feed the value of a pixel at a frame. Frames of a pixel must arrive in
+  // ascending order, zero values can be skipped. 
+  void Append(int pixel, int frame, float value);
+
+  // Flush the pending averages and normalize the sums. 
+  void Finish();
+
+private:
+
+  void Push(int slot, int pixel, int level, int frame, float value);
+
+  float* g2s_;
+  float* ips_;
+  float* ifs_;
+
+  int pixels_;
+  int levels_;
+  int register_size_;
+
+  // Number of frames available at each level. 
+  std::vector<int> level_frames_;
+
+  // Delays of each level as (index into the result, delay at that level).
+  std::vector<std::vector<std::tuple<int, int> > > level_delays_;
+
+  // Slot of every pixel that can be fed by the filters, -1 otherwise. 
+  int* slots_;
+
+  // Per slot and level state. 
+  float* registers_;
+  int* last_frame_;
+  float* pending_value_;
+  int* pending_frame_;
+};
+
+} // namespace xpcs
+
+#endif
@@ -63,6 +63,14 @@ DarkImage::DarkImage(float** data, int frames, int pixels_per_frames, double* fl
   Compute(data, frames, pixels_per_frames, flatfield);
 }
 
+DarkImage::DarkImage(short** data, int frames, int pixels_per_frames, double* flatfield)
+{
+  dark_avg_ = new double[pixels_per_frames];
+  dark_std_ = new double[pixels_per_frames];
+
+  Compute(data, frames, pixels_per_frames, flatfield);
+}
+
 DarkImage::~DarkImage()
 {
   //TODO
@@ -78,7 +86,8 @@ double* DarkImage::dark_std()
   return dark_std_;
 }
 
-void DarkImage::Compute(float** data, int frames, int pixels, double* flatfield)
+template <typename T>
+void DarkImage::Compute(T** data, int frames, int pixels, double* flatfield)
 {
 
   for (int i = 0 ; i < pixels; i++)
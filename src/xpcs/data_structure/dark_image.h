@@ -63,6 +63,8 @@ public:
   
   DarkImage(float** data, int frames, int pixelPerFrame, double* flatfield);
 
+  DarkImage(short** data, int frames, int pixelPerFrame, double* flatfield);
+
   ~DarkImage();
 
   double* dark_avg();
@@ -75,7 +77,8 @@ private:
 
   double* dark_std_;
 
-  void Compute(float** data, int frames, int pixels, double* flatfield);
+  template <typename T>
+  void Compute(T** data, int frames, int pixels, double* flatfield);
   
 };
 
@@ -47,32 +47,34 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef ROW_H
 #define ROW_H
 
-#include <vector>
+#include <stddef.h>
 
 namespace xpcs {
 namespace data_structure {
 
+/**
+ * A view over the non-zero values of a single pixel. The pointers refer to
+ * the contiguous storage owned by SparseData and are sorted by frame index. 
+ */
 class Row {
 
 public:
 
-  Row()
-  {
-    
-  }
-  Row(int size)
+  Row() : indxPtr(NULL), valPtr(NULL), size(0)
   {
-      indxPtr.reserve(size);
-      valPtr.reserve(size);
+
   }
-  ~Row()
+
+  Row(int *indx, float *val, int count) : indxPtr(indx), valPtr(val), size(count)
   {
 
   }
 
-  std::vector<int> indxPtr;
+  int *indxPtr;
   //TODO: Lets make this a template argument. 
-  std::vector<float> valPtr;
+  float *valPtr;
+
+  int size;
 
 };
 
@@ -48,6 +48,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <iostream>
+#include <algorithm>
 
 #include "xpcs/configuration.h"
 #include "xpcs/benchmark.h"
@@ -56,42 +57,124 @@ POSSIBILITY OF SUCH DAMAGE.
 namespace xpcs {
 namespace data_structure {
 
-SparseData::SparseData(int rows, int initialSize)
+SparseData::SparseData(int rows, int blockSize)
 {
+    assert(blockSize > 0 && blockSize <= 65536);
+
     m_rows = rows;
-    m_initSize = initialSize;
-    m_data = new Row*[rows];
+    m_blockSize = blockSize;
+    m_blockCount = (rows + blockSize - 1) / blockSize;
+    m_blocks = new PixelBlock[m_blockCount];
     valid_pixels_ = new short[rows];
+    finalized_ = false;
+
+    for (int b = 0; b < m_blockCount; b++) {
+      m_blocks[b].offsets = NULL;
+      m_blocks[b].indx = NULL;
+      m_blocks[b].vals = NULL;
+    }
 
     for (int i = 0; i < m_rows; i++) {
-      m_data[i] = NULL;
       valid_pixels_[i] = 0;
     }
 }
 
 SparseData::~SparseData()
 {
-  //TODO
+    for (int b = 0; b < m_blockCount; b++) {
+      delete [] m_blocks[b].offsets;
+      delete [] m_blocks[b].indx;
+      delete [] m_blocks[b].vals;
+    }
+
+    delete [] m_blocks;
+    delete [] valid_pixels_;
 }
 
-Row* SparseData::Pixel(int index)
+void SparseData::Finalize()
 {
-    // printf("index = %d\n", index);
-    assert(index < m_rows);
-    Row *r = m_data[index];
-    
-    if (!r) {
-        r = new Row(m_initSize);
-        m_data[index] = r;
+    if (finalized_) return;
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < m_blockCount; b++) {
+      PixelBlock &blk = m_blocks[b];
+      int pixels = std::min(m_blockSize, m_rows - b * m_blockSize);
+      int nnz = blk.stage_pixel.size();
+
+      // First pass, count non-zeros per pixel and turn them into offsets. 
+      int *offsets = new int[pixels + 1];
+      for (int p = 0; p <= pixels; p++)
+        offsets[p] = 0;
+
+      for (int i = 0; i < nnz; i++)
+        offsets[blk.stage_pixel[i] + 1]++;
+
+      for (int p = 0; p < pixels; p++)
+        offsets[p + 1] += offsets[p];
+
+      // Second pass, scatter the values. Staged values are in frame order, 
+      // so every pixel comes out sorted by frame. 
+      int *indx = new int[nnz];
+      float *vals = new float[nnz];
+      std::vector<int> cursor(offsets, offsets + pixels);
+
+      for (int i = 0; i < nnz; i++) {
+        int pos = cursor[blk.stage_pixel[i]]++;
+        indx[pos] = blk.stage_frame[i];
+        vals[pos] = blk.stage_value[i];
+      }
+
+      std::vector<unsigned short>().swap(blk.stage_pixel);
+      std::vector<int>().swap(blk.stage_frame);
+      std::vector<float>().swap(blk.stage_value);
+
+      blk.offsets = offsets;
+      blk.indx = indx;
+      blk.vals = vals;
+    }
+
+    for (int b = 0; b < m_blockCount; b++) {
+      PixelBlock &blk = m_blocks[b];
+      int pixels = std::min(m_blockSize, m_rows - b * m_blockSize);
+
+      for (int p = 0; p < pixels; p++) {
+        if (blk.offsets[p + 1] == blk.offsets[p]) continue;
+
+        int index = b * m_blockSize + p;
         m_validPixels.push_back(index);
         valid_pixels_[index] = 1;
+      }
     }
 
-    return r;
+    finalized_ = true;
+}
+
+Row SparseData::Pixel(int index)
+{
+    assert(finalized_);
+    assert(index < m_rows);
+
+    PixelBlock &blk = m_blocks[index / m_blockSize];
+    int p = index % m_blockSize;
+    int begin = blk.offsets[p];
+
+    return Row(blk.indx + begin, blk.vals + begin, blk.offsets[p + 1] - begin);
+}
+
+int SparseData::NonZeros(int index)
+{
+    assert(finalized_);
+    assert(index < m_rows);
+
+    PixelBlock &blk = m_blocks[index / m_blockSize];
+    int p = index % m_blockSize;
+
+    return blk.offsets[p + 1] - blk.offsets[p];
 }
 
 std::vector<int>& SparseData::ValidPixels()
 {
+    assert(finalized_);
     return m_validPixels;
 }
 
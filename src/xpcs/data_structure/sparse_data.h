@@ -49,31 +49,67 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "row.h"
 
+#include <assert.h>
 #include <vector>
 
 namespace xpcs {
 namespace data_structure {
 
+/**
+ * Pixel-major compressed storage (CSR) for a contiguous range of pixels. 
+ * Values are staged in arrival (frame) order by Append() and are 
+ * re-arranged into one index array and one value array on Finalize(). 
+ */
+struct PixelBlock {
+  // Staging area, released after the block is finalized. 
+  std::vector<unsigned short> stage_pixel;
+  std::vector<int> stage_frame;
+  std::vector<float> stage_value;
+
+  // offsets[p] .. offsets[p+1] is the range of the local pixel p. 
+  int *offsets;
+  int *indx;
+  float *vals;
+};
+
 class SparseData  {
 
 public:
 
-  SparseData(int rows, int initalSize=10);
+  SparseData(int rows, int blockSize=4096);
 
   ~SparseData();
 
-  Row* Pixel(int index);
+  // Append a non-zero value. Frames of a pixel must be appended in 
+  // ascending order, which is the order the filters produce them in. 
+  inline void Append(int pixel, int frame, float value) {
+    assert(!finalized_);
+    PixelBlock &blk = m_blocks[pixel / m_blockSize];
+    blk.stage_pixel.push_back((unsigned short) (pixel % m_blockSize));
+    blk.stage_frame.push_back(frame);
+    blk.stage_value.push_back(value);
+  }
+
+  // Build the CSR arrays from the staged values. Must be called once all 
+  // the frames are appended and before any of the accessors are used. 
+  void Finalize();
+
+  Row Pixel(int index);
+
+  int NonZeros(int index);
 
   std::vector<int>& ValidPixels();
 
   bool Exists(int index);
 
 private:
-  Row** m_data;
+  PixelBlock* m_blocks;
   
   int m_rows;
-  int m_initSize;
+  int m_blockSize;
+  int m_blockCount;
   short* valid_pixels_;
+  bool finalized_;
 
   std::vector<int> m_validPixels;
 };
@@ -47,7 +47,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "average.h"
 
-#include <set>
+#include <algorithm>
 #include <math.h>
 #include <stdio.h>
 #include <iostream>
@@ -75,7 +75,7 @@ void Average::Apply(struct xpcs::io::ImmBlock* blk) {
   int **indx = blk->index;
   float **val = blk->value;
   int frames = blk->frames;
-  std::vector<int> ppf = blk->pixels_per_frame;
+  const std::vector<int>& ppf = blk->pixels_per_frame;
 
   if (frames < 2) return;
 
@@ -83,11 +83,11 @@ void Average::Apply(struct xpcs::io::ImmBlock* blk) {
     pixels_value_[i] = 0.0;
 
   // The first frame just act as the base. 
-  std::set<int> pixels_touched; //(int(0.3 * pixels_));
+  pixels_touched_.clear();
   for (int j = 0; j < ppf[0]; j++) {
     int px = indx[0][j];
     float v = val[0][j];
-    pixels_touched.insert(px);
+    pixels_touched_.push_back(px);
     pixels_value_[px] = v; 
   }
 
@@ -95,32 +95,30 @@ void Average::Apply(struct xpcs::io::ImmBlock* blk) {
     for (int j = 0; j < ppf[i]; j++) {
       int px = indx[i][j];
       float v = val[i][j];
-      pixels_touched.insert(px);
+      pixels_touched_.push_back(px);
       pixels_value_[px] += v; 
     }
   }
 
-  int **new_index = new int*[1];
-  float **new_val = new float*[1];
-  int new_frames = 1;
-  new_index[0] = new int[pixels_touched.size()];
-  new_val[0] = new float[pixels_touched.size()];
-  std::vector<int> new_ppf = {(int)pixels_touched.size()};
-
-  int ind = 0;
-  for (std::set<int>::iterator it = pixels_touched.begin(); it != pixels_touched.end(); ++it) {
-    int px = *it;
-    new_index[0][ind] = px;
-    new_val[0][ind] = pixels_value_[px] / frames;
-    ind++;
-  }
+  std::sort(pixels_touched_.begin(), pixels_touched_.end());
+  pixels_touched_.erase(std::unique(pixels_touched_.begin(), pixels_touched_.end()), 
+                        pixels_touched_.end());
+
+  // The frames were read above, so the averaged frame can go into the 
+  // buffers of the first one. 
+  int touched = pixels_touched_.size();
+  int *new_index = blk->IndexBuffer(0, touched);
+  float *new_val = blk->ValueBuffer(0, touched);
 
-  blk->index = new_index;
-  blk->value = new_val;
-  blk->frames = new_frames;
-  blk->pixels_per_frame = new_ppf;
+  for (int ind = 0; ind < touched; ind++) {
+    int px = pixels_touched_[ind];
+    new_index[ind] = px;
+    new_val[ind] = pixels_value_[px] / frames;
+  }
 
-  //TODO smart pointers to handle memory
+  blk->frames = 1;
+  blk->pixels_per_frame.resize(1);
+  blk->pixels_per_frame[0] = touched;
 }
 
 } // namespace io
@@ -47,6 +47,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef XPCS_AVERAGE_H
 #define XPCS_AVERAGE_H
 
+#include <vector>
+
 namespace xpcs {
 
 namespace data_structure {
@@ -75,6 +77,8 @@ private:
   int pixels_;
   // An value array equal to the size of the image. 
   float *pixels_value_;
+  // Pixels of the frames being averaged, reused across blocks. 
+  std::vector<int> pixels_touched_;
 };
 
 } //namespace filter
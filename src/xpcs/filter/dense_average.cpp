@@ -75,7 +75,7 @@ void DenseAverage::Apply(struct xpcs::io::ImmBlock* blk) {
   int **indx = blk->index;
   float **val = blk->value;
   int frames = blk->frames;
-  std::vector<int> ppf = blk->pixels_per_frame;
+  const std::vector<int>& ppf = blk->pixels_per_frame;
 
   if (frames < 2) return;
 
@@ -95,27 +95,20 @@ void DenseAverage::Apply(struct xpcs::io::ImmBlock* blk) {
     }
   }
 
-  int **new_index = new int*[1];
-  float **new_val = new float*[1];
-  int new_frames = 1;
-  new_index[0] = new int[ppf[0]];
-  new_val[0] = new float[ppf[0]];
-  std::vector<int> new_ppf = {ppf[0]};
+  // The frames were read above, so the averaged frame can go into the 
+  // buffers of the first one. 
+  int pixels = ppf[0];
+  int *new_index = blk->IndexBuffer(0, pixels);
+  float *new_val = blk->ValueBuffer(0, pixels);
 
-  int ind = 0;
-  for (int i = 0; i < ppf[0]; i++) {
+  for (int i = 0; i < pixels; i++) {
     int px = i;
-    new_index[0][ind] = px;
-    new_val[0][ind] = pixels_value_[px] / (float)(average_size_);
-    ind++;
+    new_index[i] = px;
+    new_val[i] = pixels_value_[px] / (float)(average_size_);
   }
 
-  blk->index = new_index;
-  blk->value = new_val;
-  blk->frames = new_frames;
-  blk->pixels_per_frame = new_ppf;
-
-  //TODO smart pointers to handle memory
+  blk->frames = 1;
+  blk->pixels_per_frame.resize(1);
 }
 
 } // namespace io
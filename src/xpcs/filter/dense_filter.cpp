@@ -52,9 +52,15 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <iostream>
 #include <set>
+#include <algorithm>
+
+#include <omp.h>
+
+#include "spdlog/spdlog.h"
 
 #include "xpcs/configuration.h"
 #include "xpcs/io/reader.h"
+#include "xpcs/corr_stream.h"
 #include "xpcs/data_structure/sparse_data.h"
 #include "xpcs/data_structure/dark_image.h"
 
@@ -62,7 +68,7 @@ namespace xpcs {
 namespace filter {
 
 
-DenseFilter::DenseFilter(xpcs::data_structure::DarkImage *dark_image) {
+DenseFilter::DenseFilter(xpcs::data_structure::DarkImage *dark_image, DenseKernel::Isa isa) {
 
   dark_image_ = dark_image;
 
@@ -90,8 +96,6 @@ DenseFilter::DenseFilter(xpcs::data_structure::DarkImage *dark_image) {
   partitions_mean_ = new float[total_static_partns_];
   pixels_sum_ = new float[frame_width_ * frame_height_];
   frames_sum_ =  new float[2 * conf->getFrameTodoCount()];
-  pixels_value_ = new float[frame_width_ * frame_height_];
-  sparse_map_ = new short[frame_width_ * frame_height_];
 
   real_frames_todo_ = conf->getRealFrameTodoCount();
   timestamp_clock_ = new double[2 * real_frames_todo_];
@@ -110,91 +114,153 @@ DenseFilter::DenseFilter(xpcs::data_structure::DarkImage *dark_image) {
   for (int i = 0; i < (frame_width_ * frame_height_); i++)
     pixels_sum_[i] = 0.0f;
 
+  double *dark_avg = NULL;
+  double *dark_std = NULL;
+
+  if (dark_image_ != NULL) {
+    dark_avg = dark_image_->dark_avg();
+    dark_std = dark_image_->dark_std();
+  }
+
+  kernel_ = new DenseKernel(frame_width_ * frame_height_, pixel_mask_, flatfield_, 
+                            dark_avg, dark_std, threshold_, sigma_, isa);
+  workspaces_.resize(omp_get_max_threads(), NULL);
+
+  spdlog::get("console")->debug("Dense filter kernel: {}", DenseKernel::Name(kernel_->isa()));
+
   data_ = new xpcs::data_structure::SparseData(frame_width_ * frame_height_);
+  stream_ = NULL;
 
 }
 
 DenseFilter::~DenseFilter() {
+  delete kernel_;
 
+  for (size_t t = 0; t < workspaces_.size(); t++) {
+    if (workspaces_[t] == NULL) continue;
+
+    delete [] workspaces_[t]->sparse_map;
+    delete [] workspaces_[t]->pixels_value;
+    delete [] workspaces_[t]->passed_index;
+    delete [] workspaces_[t]->passed_value;
+    delete workspaces_[t];
+  }
 }
 
-void DenseFilter::Apply(struct xpcs::io::ImmBlock* blk) {
-  int **indx = blk->index;
-  float **val = blk->value;
-  int frames = blk->frames;
+DenseFilter::Workspace* DenseFilter::ThreadWorkspace() {
+  int t = omp_get_thread_num();
+  if (workspaces_[t] != NULL)
+    return workspaces_[t];
+
   int pix_cnt = frame_width_ * frame_height_;
 
-  for (int i = 0; i < frames; i++) {
-    timestamp_clock_[global_frame_index_] = global_frame_index_ + 1;
-    timestamp_clock_[global_frame_index_ + real_frames_todo_] = blk->clock[i];
-    timestamp_ticks_[global_frame_index_] = global_frame_index_ + 1;
-    timestamp_ticks_[global_frame_index_ + real_frames_todo_] = blk->ticks[i];
-    global_frame_index_++;
+  Workspace *ws = new Workspace;
+  ws->sparse_map = new short[pix_cnt];
+  ws->pixels_value = new float[pix_cnt];
+  ws->passed_index = new int[pix_cnt];
+  ws->passed_value = new float[pix_cnt];
+
+  for (int i = 0; i < pix_cnt; i++)
+    ws->sparse_map[i] = 0;
+
+  workspaces_[t] = ws;
+  return ws;
+}
+
+template <typename T>
+void DenseFilter::AccumulateFrame(Workspace *ws, std::vector<int> &touched, const T *value, int pixels) {
+  int passed = kernel_->Apply(value, pixels, ws->passed_index, ws->passed_value);
+
+  for (int k = 0; k < passed; k++) {
+    int pix = ws->passed_index[k];
+
+    if (ws->sparse_map[pix] == 0) {
+      ws->sparse_map[pix] = 1;
+      ws->pixels_value[pix] = 0.0f;
+      touched.push_back(pix);
+    }
+
+    ws->pixels_value[pix] += ws->passed_value[k];
   }
+}
 
-  double *dark_avg = NULL;
-  double *dark_std = NULL;
+void DenseFilter::Apply(struct xpcs::io::ImmBlock* blk) {
+  Apply(&blk, 1);
+}
 
-  if (dark_image_ != NULL) {
-    dark_avg = dark_image_->dark_avg();
-    dark_std = dark_image_->dark_std();
+void DenseFilter::Apply(struct xpcs::io::ImmBlock** blocks, int count) {
+  if ((int)filtered_.size() < count)
+    filtered_.resize(count);
+
+#pragma omp parallel for schedule(dynamic) if(count > 1)
+  for (int b = 0; b < count; b++)
+    FilterBlock(blocks[b], &filtered_[b]);
+
+  // In frame order, so the pixel store and the sums come out the same as 
+  // with one block at a time. 
+  for (int b = 0; b < count; b++) {
+    AppendTimestamps(blocks[b]);
+    AppendFrame(filtered_[b]);
+    blocks[b]->Release();
   }
+}
 
-  std::vector<int> ppf = blk->pixels_per_frame;
+void DenseFilter::FilterBlock(struct xpcs::io::ImmBlock* blk, FilteredFrame *out) {
+  Workspace *ws = ThreadWorkspace();
+  std::vector<int> &touched = out->index;
+  std::vector<int> &ppf = blk->pixels_per_frame;
+
+  touched.clear();
+  for (int i = 0; i < blk->frames; i+=stride_size_) {
+    if (blk->value16)
+      AccumulateFrame(ws, touched, blk->value16[i], ppf[i]);
+    else
+      AccumulateFrame(ws, touched, blk->value[i], ppf[i]);
+  }
+
+  // Later frames add pixels out of order, the output goes by pixel index. 
+  std::sort(touched.begin(), touched.end());
 
-  for (int j = 0; j < pix_cnt; j++) {
-    pixels_value_[j] = 0.0f;
-    sparse_map_[j] = 0;
+  out->value.resize(touched.size());
+  for (size_t k = 0; k < touched.size(); k++) {
+    int pix = touched[k];
+    out->value[k] = ws->pixels_value[pix];
+    ws->sparse_map[pix] = 0;
   }
+}
 
-  for (int i = 0; i < frames; i+=stride_size_) {
-    int pixels = ppf[i];
-    int *index = indx[i];
-    float *value = val[i];
-
-    for (int j = 0; j < pixels; j++) {
-
-      if (pixel_mask_[j] != 0) {
-        int pix = j;
-        float v = value[j];
-        float thresh = 0.0f;
-
-        if (dark_avg) {
-          v = v - dark_avg[j];
-          v = std::max(v, 0.0f);
-          thresh = threshold_ + sigma_ * dark_std[j];
-        }
-        if (v <= thresh) continue;
-
-        sparse_map_[pix] = 1;
-        v = v * flatfield_[j];
-        pixels_value_[pix] += v;
-      }
-    }
+void DenseFilter::AppendTimestamps(struct xpcs::io::ImmBlock* blk) {
+  for (int i = 0; i < blk->frames; i++) {
+    timestamp_clock_[global_frame_index_] = global_frame_index_ + 1;
+    timestamp_clock_[global_frame_index_ + real_frames_todo_] = blk->clock[i];
+    timestamp_ticks_[global_frame_index_] = global_frame_index_ + 1;
+    timestamp_ticks_[global_frame_index_ + real_frames_todo_] = blk->ticks[i];
+    global_frame_index_++;
   }
+}
+
+void DenseFilter::AppendFrame(const FilteredFrame &frame) {
+  int pix_cnt = frame_width_ * frame_height_;
 
   if (frame_index_ > 0 && (frame_index_ % static_window_) == 0) {
     partition_no_++;
   }
 
-  int ind = 0;
   float f_sum = 0.0f;
   int sbin = 0;
 
-  for (int i = 0; i < pix_cnt; i++) {
-    if (sparse_map_[i] == 0)
-      continue;
+  for (size_t i = 0; i < frame.index.size(); i++) {
+    int pix = frame.index[i];
 
-    int pix = i;
-
-    float v = pixels_value_[pix] / average_size_;
+    float v = frame.value[i] / average_size_;
 
     pixels_sum_[pix] += v;
     f_sum += v;
 
-    xpcs::data_structure::Row *row = data_->Pixel(pix);
-    row->indxPtr.push_back(frame_index_);
-    row->valPtr.push_back(v);
+    if (stream_)
+      stream_->Append(pix, frame_index_, v);
+    else
+      data_->Append(pix, frame_index_, v);
 
     sbin = sbin_mask_[pix] - 1;
     partitions_mean_[sbin] += v;
@@ -205,8 +271,6 @@ void DenseFilter::Apply(struct xpcs::io::ImmBlock* blk) {
   frames_sum_[frame_index_] = frame_index_ + 1.0;
   frames_sum_[frame_index_ + frames_todo_] = f_sum / pix_cnt;
   frame_index_++;
-
-
 }
 
 float* DenseFilter::PixelsSum() {
@@ -226,6 +290,10 @@ float* DenseFilter::PartialPartitionsMean() {
 }
 
 
+void DenseFilter::Stream(xpcs::CorrStream* stream) {
+  stream_ = stream;
+}
+
 xpcs::data_structure::SparseData* DenseFilter::Data() {
   return data_;
 }
@@ -47,10 +47,15 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef XPCS_DENSE_FILTER_H
 #define XPCS_DENSE_FILTER_H
 
+#include <vector>
+
 #include "filter.h"
+#include "dense_kernel.h"
 
 namespace xpcs {
 
+class CorrStream;
+
 namespace data_structure {
   class SparseData;
   class DarkImage;
@@ -65,12 +70,15 @@ namespace filter {
 class DenseFilter : public Filter  {
 
 public:
-  DenseFilter(xpcs::data_structure::DarkImage* dark_image);
+  DenseFilter(xpcs::data_structure::DarkImage* dark_image, 
+              DenseKernel::Isa isa = DenseKernel::kAuto);
 
   ~DenseFilter();
 
   void Apply(struct xpcs::io::ImmBlock* data);
 
+  void Apply(struct xpcs::io::ImmBlock** blocks, int count);
+
   float* PixelsSum();
 
   float* FramesSum();
@@ -83,26 +91,55 @@ public:
 
   double* TimestampTicks();
 
+  void Stream(xpcs::CorrStream* stream);
+
   xpcs::data_structure::SparseData* Data();
 
 private:
 
+  // Frame-sized scratch of one filtering thread, allocated on first use. 
+  struct Workspace {
+    short *sparse_map;
+    float *pixels_value;
+    // Pixels that passed the kernel for the current frame.
+    int *passed_index;
+    float *passed_value;
+  };
+
+  Workspace* ThreadWorkspace();
+
+  template <typename T>
+  void AccumulateFrame(Workspace *ws, std::vector<int> &touched, const T *value, int pixels);
+
+  // Thresholds the frames of the block, safe to run on several threads.
+  void FilterBlock(struct xpcs::io::ImmBlock* blk, FilteredFrame *out);
+
+  void AppendTimestamps(struct xpcs::io::ImmBlock* blk);
+
+  void AppendFrame(const FilteredFrame &frame);
+
   xpcs::data_structure::SparseData *data_;
 
+  xpcs::CorrStream *stream_;
+
   xpcs::data_structure::DarkImage *dark_image_;
 
   short *pixel_mask_;
 
   int *sbin_mask_;
 
-  short *sparse_map_;
+  DenseKernel *kernel_;
+
+  // One per OpenMP thread. 
+  std::vector<Workspace*> workspaces_;
+
+  // Filtered blocks of the current batch. 
+  std::vector<FilteredFrame> filtered_;
 
   float sigma_;
 
   float threshold_;
 
-  float *pixels_value_;
-
   float *pixels_sum_;
 
   float *frames_sum_;
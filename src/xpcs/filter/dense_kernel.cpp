@@ -0,0 +1,270 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#include "dense_kernel.h"
+
+#include <limits>
+#include <algorithm>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define XPCS_DENSE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace xpcs {
+namespace filter {
+
+template <typename T>
+static int ThresholdScalar(const T *frame, int begin, int end, 
+                           const double *dark, const float *thresh, const double *flat, 
+                           int *index, float *value) {
+  int n = 0;
+  for (int j = begin; j < end; j++) {
+    float v = frame[j] - dark[j];
+    v = std::max(v, 0.0f);
+    if (v <= thresh[j]) continue;
+
+    index[n] = j;
+    value[n] = v * flat[j];
+    n++;
+  }
+
+  return n;
+}
+
+#ifdef XPCS_DENSE_KERNEL_X86
+
+// Lane permutations that move the lanes set in an 8-bit mask to the front. 
+static int kCompress8[256][8];
+
+static void BuildCompress8() {
+  for (int m = 0; m < 256; m++) {
+    int k = 0;
+    for (int lane = 0; lane < 8; lane++) {
+      if (m & (1 << lane)) kCompress8[m][k++] = lane;
+    }
+    while (k < 8) kCompress8[m][k++] = 0;
+  }
+}
+
+__attribute__((target("avx2")))
+static inline __m256 Load8(const short *p) {
+  return _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)p)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 Load8(const float *p) {
+  return _mm256_loadu_ps(p);
+}
+
+// The subtraction and the flatfield are done in double and rounded to float
+// like the scalar code, std::max(v, 0) is max(0, v) and v <= thresh is the 
+// complement of the unordered not-less-equal compare, also for NaNs. 
+template <typename T>
+__attribute__((target("avx2")))
+static int ThresholdAvx2(const T *frame, int pixels, 
+                         const double *dark, const float *thresh, const double *flat, 
+                         int *index, float *value) {
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+  int n = 0;
+  int j = 0;
+  for (; j + 8 <= pixels; j += 8) {
+    __m256 x = Load8(frame + j);
+    __m256d lo = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), _mm256_loadu_pd(dark + j));
+    __m256d hi = _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), _mm256_loadu_pd(dark + j + 4));
+    __m256 v = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1);
+    v = _mm256_max_ps(zero, v);
+
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(v, _mm256_loadu_ps(thresh + j), _CMP_NLE_UQ));
+    if (mask == 0) continue;
+
+    lo = _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(v)), _mm256_loadu_pd(flat + j));
+    hi = _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)), _mm256_loadu_pd(flat + j + 4));
+    v = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(lo)), _mm256_cvtpd_ps(hi), 1);
+
+    // Compress-store through a permutation, the lanes past the kept ones 
+    // are overwritten by the next store. n <= j, so it stays in bounds. 
+    __m256i perm = _mm256_loadu_si256((const __m256i*)kCompress8[mask]);
+    __m256i pix = _mm256_add_epi32(_mm256_set1_epi32(j), lanes);
+    _mm256_storeu_ps(value + n, _mm256_permutevar8x32_ps(v, perm));
+    _mm256_storeu_si256((__m256i*)(index + n), _mm256_permutevar8x32_epi32(pix, perm));
+    n += __builtin_popcount(mask);
+  }
+
+  return n + ThresholdScalar(frame, j, pixels, dark, thresh, flat, index + n, value + n);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 Load16(const short *p) {
+  return _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i*)p)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 Load16(const float *p) {
+  return _mm512_loadu_ps(p);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 Join16(__m256 lo, __m256 hi) {
+  return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(lo)), 
+                                             _mm256_castps_pd(hi), 1));
+}
+
+template <typename T>
+__attribute__((target("avx512f")))
+static int ThresholdAvx512(const T *frame, int pixels, 
+                           const double *dark, const float *thresh, const double *flat, 
+                           int *index, float *value) {
+  const __m512 zero = _mm512_setzero_ps();
+  const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+  int n = 0;
+  int j = 0;
+  for (; j + 16 <= pixels; j += 16) {
+    __m512 x = Load16(frame + j);
+    __m256 xhi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1));
+    __m512d lo = _mm512_sub_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(x)), _mm512_loadu_pd(dark + j));
+    __m512d hi = _mm512_sub_pd(_mm512_cvtps_pd(xhi), _mm512_loadu_pd(dark + j + 8));
+    __m512 v = _mm512_max_ps(zero, Join16(_mm512_cvtpd_ps(lo), _mm512_cvtpd_ps(hi)));
+
+    __mmask16 mask = _mm512_cmp_ps_mask(v, _mm512_loadu_ps(thresh + j), _CMP_NLE_UQ);
+    if (mask == 0) continue;
+
+    __m256 vhi = _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1));
+    lo = _mm512_mul_pd(_mm512_cvtps_pd(_mm512_castps512_ps256(v)), _mm512_loadu_pd(flat + j));
+    hi = _mm512_mul_pd(_mm512_cvtps_pd(vhi), _mm512_loadu_pd(flat + j + 8));
+    v = Join16(_mm512_cvtpd_ps(lo), _mm512_cvtpd_ps(hi));
+
+    __m512i pix = _mm512_add_epi32(_mm512_set1_epi32(j), lanes);
+    _mm512_mask_compressstoreu_ps(value + n, mask, v);
+    _mm512_mask_compressstoreu_epi32(index + n, mask, pix);
+    n += __builtin_popcount(mask);
+  }
+
+  return n + ThresholdScalar(frame, j, pixels, dark, thresh, flat, index + n, value + n);
+}
+
+#endif
+
+DenseKernel::DenseKernel(int pixels, 
+                         const short *pixel_mask, 
+                         const double *flatfield, 
+                         const double *dark_avg, 
+                         const double *dark_std, 
+                         float threshold, 
+                         float sigma, 
+                         Isa isa) : pixels_(pixels), flatfield_(flatfield) {
+
+  dark_ = new double[pixels];
+  thresh_ = new float[pixels];
+
+  for (int j = 0; j < pixels; j++) {
+    float thresh = 0.0f;
+    if (dark_avg)
+      thresh = threshold + sigma * dark_std[j];
+
+    dark_[j] = dark_avg ? dark_avg[j] : 0.0;
+    thresh_[j] = pixel_mask[j] != 0 ? thresh : std::numeric_limits<float>::infinity();
+  }
+
+  // The best kernel the CPU runs, but not better than the one asked for. 
+  isa_ = kScalar;
+#ifdef XPCS_DENSE_KERNEL_X86
+  BuildCompress8();
+
+  __builtin_cpu_init();
+  if ((isa == kAuto || isa == kAvx512) && __builtin_cpu_supports("avx512f"))
+    isa_ = kAvx512;
+  else if ((isa == kAuto || isa == kAvx512 || isa == kAvx2) && __builtin_cpu_supports("avx2"))
+    isa_ = kAvx2;
+#endif
+}
+
+DenseKernel::~DenseKernel() {
+  delete [] dark_;
+  delete [] thresh_;
+}
+
+template <typename T>
+int DenseKernel::Dispatch(const T *frame, int pixels, int *index, float *value) {
+  pixels = std::min(pixels, pixels_);
+
+#ifdef XPCS_DENSE_KERNEL_X86
+  if (isa_ == kAvx512)
+    return ThresholdAvx512(frame, pixels, dark_, thresh_, flatfield_, index, value);
+  if (isa_ == kAvx2)
+    return ThresholdAvx2(frame, pixels, dark_, thresh_, flatfield_, index, value);
+#endif
+
+  return ThresholdScalar(frame, 0, pixels, dark_, thresh_, flatfield_, index, value);
+}
+
+int DenseKernel::Apply(const short *frame, int pixels, int *index, float *value) {
+  return Dispatch(frame, pixels, index, value);
+}
+
+int DenseKernel::Apply(const float *frame, int pixels, int *index, float *value) {
+  return Dispatch(frame, pixels, index, value);
+}
+
+DenseKernel::Isa DenseKernel::isa() {
+  return isa_;
+}
+
+const char* DenseKernel::Name(Isa isa) {
+  switch (isa) {
+    case kAvx512: return "avx512";
+    case kAvx2: return "avx2";
+    case kScalar: return "scalar";
+    default: return "auto";
+  }
+}
+
+} // namespace filter
+} // namespace xpcs
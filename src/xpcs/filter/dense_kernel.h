@@ -0,0 +1,110 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#ifndef XPCS_DENSE_KERNEL_H
+#define XPCS_DENSE_KERNEL_H
+
+namespace xpcs {
+namespace filter {  
+
+/**
+ * Dark subtraction, threshold and flatfield of a dense frame. The pixel 
+ * mask is folded into per-pixel float thresholds (masked pixels never pass)
+ * that are computed once, and the pixels above their threshold are written
+ * out compacted as indices and flatfielded values. 
+ * 
+ * The AVX-512 and AVX2 kernels are picked at runtime from what the CPU 
+ * supports, they compute exactly what the scalar fallback does. 
+ */
+class DenseKernel {
+
+public:
+
+  enum Isa { kAuto, kScalar, kAvx2, kAvx512 };
+
+  // dark_avg and dark_std may be NULL when there is no dark image. 
+  DenseKernel(int pixels, 
+              const short *pixel_mask, 
+              const double *flatfield, 
+              const double *dark_avg, 
+              const double *dark_std, 
+              float threshold, 
+              float sigma, 
+              Isa isa = kAuto);
+
+  ~DenseKernel();
+
+  // Filters the first `pixels` pixels of the frame into index and value, 
+  // which hold at least that many elements, and returns how many passed. 
+  int Apply(const short *frame, int pixels, int *index, float *value);
+
+  int Apply(const float *frame, int pixels, int *index, float *value);
+
+  Isa isa();
+
+  static const char* Name(Isa isa);
+
+private:
+
+  template <typename T>
+  int Dispatch(const T *frame, int pixels, int *index, float *value);
+
+  int pixels_;
+
+  Isa isa_;
+
+  double *dark_;
+
+  float *thresh_;
+
+  const double *flatfield_;
+};
+
+} //namespace filter
+} //namespace xpcs
+
+#endif
@@ -47,8 +47,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef XPCS_FILTER_H
 #define XPCS_FILTER_H
 
+#include <vector>
+
 namespace xpcs {
 
+class CorrStream;
+
 namespace data_structure {
   class SparseData;
 }
@@ -59,12 +63,25 @@ namespace io {
 
 namespace filter {  
 
+// One block filtered into an output frame: the pixels with a value, 
+// ascending, and their values summed over the frames of the block. 
+struct FilteredFrame {
+  std::vector<int> index;
+  std::vector<float> value;
+};
+
 class Filter  {
 
 public:
 
+  // Filters the block into the next frame and releases it. 
   virtual void Apply(struct xpcs::io::ImmBlock* block) = 0;
 
+  // Filters `count` consecutive blocks on the OpenMP threads and appends
+  // them in order, with the same results as applying them one at a time. 
+  // The blocks are released. 
+  virtual void Apply(struct xpcs::io::ImmBlock** blocks, int count) = 0;
+
   virtual float* PixelsSum() = 0;
 
   virtual float* FramesSum() = 0;
@@ -77,7 +94,10 @@ public:
 
   virtual double* TimestampTicks() = 0;
 
-  
+  // Send the filtered values to a streaming correlator instead of storing 
+  // them in Data().
+  virtual void Stream(xpcs::CorrStream* stream) = 0;
+
   virtual xpcs::data_structure::SparseData* Data() = 0;
 
   
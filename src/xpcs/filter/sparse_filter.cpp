@@ -49,17 +49,23 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <math.h>
 #include <set>
+#include <algorithm>
 
+#include <omp.h>
 #include <stdio.h>
 #include <iostream>
 
 #include "xpcs/configuration.h"
 #include "xpcs/io/reader.h"
+#include "xpcs/io/ufxc_reader.h"
+#include "xpcs/corr_stream.h"
 #include "xpcs/data_structure/sparse_data.h"
 
 namespace xpcs {
 namespace filter {
 
+// Frames filtered per NextEvents() call of ApplyEvents(). 
+static const int kEventFrames = 1024;
 
 SparseFilter::SparseFilter() {
   Configuration *conf = Configuration::instance();
@@ -86,8 +92,6 @@ SparseFilter::SparseFilter() {
   partitions_mean_ = new float[total_static_partns_];
   pixels_sum_ = new float[frame_width_ * frame_height_];
   frames_sum_ =  new float[2 * conf->getFrameTodoCount()];
-  pixels_value_ = new float[frame_width_ * frame_height_];
-  sparse_map_ = new short[frame_width_ * frame_height_];
   real_frames_todo_ = conf->getRealFrameTodoCount();
   timestamp_clock_ = new double[2 * real_frames_todo_];
   timestamp_ticks_ = new double[2 * real_frames_todo_];
@@ -105,73 +109,241 @@ SparseFilter::SparseFilter() {
   for (int i = 0; i < (frame_width_ * frame_height_); i++)
     pixels_sum_[i] = 0.0f;
 
+  workspaces_.resize(omp_get_max_threads(), NULL);
+
   data_ = new xpcs::data_structure::SparseData(frame_width_ * frame_height_);
+  stream_ = NULL;
 
 }
 
 SparseFilter::~SparseFilter() {
+  for (size_t t = 0; t < workspaces_.size(); t++) {
+    if (workspaces_[t] == NULL) continue;
 
+    delete [] workspaces_[t]->sparse_map;
+    delete [] workspaces_[t]->pixels_value;
+    delete workspaces_[t];
+  }
+}
+
+SparseFilter::Workspace* SparseFilter::ThreadWorkspace() {
+  int t = omp_get_thread_num();
+  if (workspaces_[t] != NULL)
+    return workspaces_[t];
+
+  int pix_cnt = frame_width_ * frame_height_;
+
+  Workspace *ws = new Workspace;
+  ws->sparse_map = new short[pix_cnt];
+  ws->pixels_value = new float[pix_cnt];
+
+  for (int i = 0; i < pix_cnt; i++)
+    ws->sparse_map[i] = 0;
+
+  workspaces_[t] = ws;
+  return ws;
+}
+
+template <typename T>
+void SparseFilter::AccumulateFrame(Workspace *ws, std::vector<int> &touched, 
+                                   const int *index, const T *value, int pixels) {
+  for (int j = 0; j < pixels; j++) {
+
+    if (pixel_mask_[index[j]] != 0) {
+      int pix = index[j];
+      float v = value[j] * flatfield_[pix];
+
+      // First value of the pixel in this frame. 
+      if (ws->sparse_map[pix] == 0) {
+        ws->sparse_map[pix] = 1; 
+        ws->pixels_value[pix] = 0.0f;
+        touched.push_back(pix);
+      }
+
+      ws->pixels_value[pix] += v;
+    }
+  }
+}
+
+void SparseFilter::CollectFrame(Workspace *ws, FilteredFrame *out) {
+  std::vector<int> &touched = out->index;
+  std::sort(touched.begin(), touched.end());
+
+  out->value.resize(touched.size());
+  for (size_t k = 0; k < touched.size(); k++) {
+    int pix = touched[k];
+    out->value[k] = ws->pixels_value[pix];
+    ws->sparse_map[pix] = 0;
+  }
 }
 
 void SparseFilter::Apply(xpcs::io::ImmBlock* blk) {
+  Apply(&blk, 1);
+}
+
+void SparseFilter::Apply(xpcs::io::ImmBlock** blocks, int count) {
+  if ((int)filtered_.size() < count)
+    filtered_.resize(count);
+
+#pragma omp parallel for schedule(dynamic) if(count > 1)
+  for (int b = 0; b < count; b++)
+    FilterBlock(blocks[b], &filtered_[b]);
+
+  // In frame order, so the pixel store and the sums come out the same as 
+  // with one block at a time. 
+  for (int b = 0; b < count; b++) {
+    AppendTimestamps(blocks[b]);
+    AppendFrame(filtered_[b]);
+    blocks[b]->Release();
+  }
+}
+
+void SparseFilter::FilterBlock(xpcs::io::ImmBlock* blk, FilteredFrame *out) {
+  Workspace *ws = ThreadWorkspace();
   int **indx = blk->index;
   float **val = blk->value;
-  int frames = blk->frames;
-  int pix_cnt = frame_width_ * frame_height_;
-  std::vector<int> ppf = blk->pixels_per_frame;
+  const std::vector<int>& ppf = blk->pixels_per_frame;
 
-  for (int j = 0; j < pix_cnt; j++) {
-    pixels_value_[j] = 0.0f;
-    sparse_map_[j] = 0;
+  // Keep track of pixels that were part of any of the frame. 
+  out->index.clear();
+  for (int i = 0; i < blk->frames; i+=stride_size_) {
+    if (blk->value16)
+      AccumulateFrame(ws, out->index, indx[i], blk->value16[i], ppf[i]);
+    else
+      AccumulateFrame(ws, out->index, indx[i], val[i], ppf[i]);
   }
 
+  CollectFrame(ws, out);
+}
+
+void SparseFilter::AppendTimestamps(xpcs::io::ImmBlock* blk) {
   // Get the clock information from the blks
-  for (int i = 0; i < frames; i++) {
+  for (int i = 0; i < blk->frames; i++) {
     timestamp_clock_[global_frame_index_] = global_frame_index_ + 1;
     timestamp_clock_[global_frame_index_ + real_frames_todo_] = blk->clock[i];
     timestamp_ticks_[global_frame_index_] = global_frame_index_ + 1;
     timestamp_ticks_[global_frame_index_ + real_frames_todo_] = blk->ticks[i];
     global_frame_index_++;
   }
+}
 
-  // Keep track of pixels that were part of any of the frame. 
-  for (int i = 0; i < frames; i+=stride_size_) {
-    int pixels = ppf[i];
-    int *index = indx[i];
-    float *value = val[i];
+void SparseFilter::ApplyEvents(xpcs::io::UfxcReader* reader, int frames, int read_in_count) {
+  int pix_cnt = frame_width_ * frame_height_;
+
+  // Start of every pixel's events in order, and the events grouped by pixel.
+  std::vector<int> offsets(pix_cnt + 1);
+  std::vector<int> order;
+  std::vector<float> frame_sums;
+
+  for (int f0 = 0; f0 < frames; f0 += kEventFrames) {
+    int count = std::min(kEventFrames, frames - f0);
+
+    int first;
+    const int *frame, *index;
+    const float *value;
+    long events = reader->NextEvents(count * read_in_count, &first, &frame, &index, &value);
+
+    for (int i = 0; i < count * read_in_count; i++) {
+      timestamp_clock_[global_frame_index_] = global_frame_index_ + 1;
+      timestamp_clock_[global_frame_index_ + real_frames_todo_] = first + i;
+      timestamp_ticks_[global_frame_index_] = global_frame_index_ + 1;
+      timestamp_ticks_[global_frame_index_ + real_frames_todo_] = first + i;
+      global_frame_index_++;
+    }
+
+    // Counting sort of the events that are kept by pixel. Within a pixel 
+    // they stay in file order, which is frame order up to late words. 
+    std::fill(offsets.begin(), offsets.end(), 0);
+    for (long e = 0; e < events; e++) {
+      if (pixel_mask_[index[e]] != 0 && (frame[e] % read_in_count) % stride_size_ == 0)
+        offsets[index[e] + 1]++;
+    }
+
+    for (int p = 0; p < pix_cnt; p++)
+      offsets[p + 1] += offsets[p];
+
+    order.resize(offsets[pix_cnt]);
+    for (long e = 0; e < events; e++) {
+      if (pixel_mask_[index[e]] != 0 && (frame[e] % read_in_count) % stride_size_ == 0)
+        order[offsets[index[e]]++] = e;
+    }
+
+    // The fill advanced every start to the next pixel's start. 
+    for (int p = pix_cnt; p > 0; p--)
+      offsets[p] = offsets[p - 1];
+    offsets[0] = 0;
 
-    for (int j = 0; j < pixels; j++) {
+    frame_sums.assign(count, 0.0f);
 
-      if (pixel_mask_[index[j]] != 0) {
-        int pix = index[j];
-        float v = value[j] * flatfield_[pix];
+    // One pass over each pixel's photons, in pixel and then frame order as 
+    // Apply() produces them. Photons of the frames averaged into one frame 
+    // are summed the same way Apply() sums them. 
+    for (int pix = 0; pix < pix_cnt; pix++) {
+      int *begin = &order[0] + offsets[pix];
+      int *end = &order[0] + offsets[pix + 1];
+      if (begin == end) continue;
 
-        pixels_value_[pix] += v;
-        sparse_map_[pix] = 1; 
+      auto by_frame = [&](int a, int b) { return frame[a] < frame[b]; };
+      if (!std::is_sorted(begin, end, by_frame))
+        std::stable_sort(begin, end, by_frame);
+
+      int sbin = sbin_mask_[pix] - 1;
+
+      for (int *e = begin; e < end; ) {
+        int out = frame[*e] / read_in_count;
+        float sum = 0.0f;
+        for (; e < end && frame[*e] / read_in_count == out; e++) {
+          float v = value[*e] * flatfield_[pix];
+          sum += v;
+        }
+
+        float v = sum / (float)average_size_;
+        int f = f0 + out;
+
+        pixels_sum_[pix] += v;
+        frame_sums[out] += v;
+
+        if (stream_)
+          stream_->Append(pix, f, v);
+        else
+          data_->Append(pix, f, v);
+
+        partitions_mean_[sbin] += v;
+        partial_partitions_mean_[(f / static_window_) * total_static_partns_ + sbin] += v;
       }
     }
+
+    for (int i = 0; i < count; i++) {
+      frames_sum_[f0 + i] = f0 + i + 1.0;
+      frames_sum_[f0 + i + frames_todo_] = frame_sums[i] / (float)pix_cnt;
+    }
   }
 
+  frame_index_ += frames;
+}
+
+void SparseFilter::AppendFrame(const FilteredFrame &frame) {
+  int pix_cnt = frame_width_ * frame_height_;
+
   if (frame_index_ > 0 && (frame_index_ % static_window_) == 0) {
     partition_no_++;
   }
 
-  int ind = 0;
   float f_sum = 0.0f;
   int sbin = 0;
 
-  for (int i = 0 ; i < pix_cnt; i++) {
-    if (sparse_map_[i] == 0) continue;
+  for (size_t i = 0 ; i < frame.index.size(); i++) {
+    int pix = frame.index[i];
 
-    int pix = i;
-    float v = pixels_value_[pix] /(float)average_size_;
+    float v = frame.value[i] /(float)average_size_;
 
     pixels_sum_[pix] += v;
     f_sum += v;
 
-    xpcs::data_structure::Row *row = data_->Pixel(pix);
-    row->indxPtr.push_back(frame_index_);
-    row->valPtr.push_back(v);
+    if (stream_)
+      stream_->Append(pix, frame_index_, v);
+    else
+      data_->Append(pix, frame_index_, v);
 
     sbin = sbin_mask_[pix] - 1;
     partitions_mean_[sbin] += v;
@@ -209,6 +381,10 @@ double* SparseFilter::TimestampTicks() {
   return timestamp_ticks_;
 }
 
+void SparseFilter::Stream(xpcs::CorrStream* stream) {
+  stream_ = stream;
+}
+
 xpcs::data_structure::SparseData* SparseFilter::Data() {
   return data_;
 }
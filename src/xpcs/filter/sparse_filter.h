@@ -49,14 +49,19 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "filter.h"
 
+#include <vector>
+
 namespace xpcs {
 
+class CorrStream;
+
 namespace data_structure {
   class SparseData;
 }
 
 namespace io {
   struct ImmBlock;
+  class UfxcReader;
 }
 
 namespace filter {  
@@ -70,6 +75,17 @@ public:
 
   void Apply(xpcs::io::ImmBlock* data);
 
+  void Apply(xpcs::io::ImmBlock** blocks, int count);
+
+  /**
+   * Filters `frames` frames of `read_in_count` UFXC frames each straight from
+   * the photon events of the reader. The events are grouped into per-pixel 
+   * photon lists and appended pixel by pixel, no frames are built and empty 
+   * frames cost nothing. The results are those of Apply(), up to the order 
+   * the partition means are summed in. 
+   */
+  void ApplyEvents(xpcs::io::UfxcReader* reader, int frames, int read_in_count);
+
   float* PixelsSum();
 
   float* FramesSum();
@@ -82,19 +98,50 @@ public:
 
   double* TimestampTicks();
 
+  void Stream(xpcs::CorrStream* stream);
+
   xpcs::data_structure::SparseData* Data();
 
 private:
 
+  // Frame-sized scratch of one filtering thread, allocated on first use. 
+  // Only the pixels touched by a frame are marked, so a frame costs its 
+  // nonzeros rather than the detector size. 
+  struct Workspace {
+    short *sparse_map;
+    float *pixels_value;
+  };
+
+  Workspace* ThreadWorkspace();
+
+  template <typename T>
+  void AccumulateFrame(Workspace *ws, std::vector<int> &touched, 
+                       const int *index, const T *value, int pixels);
+
+  // Sorts the touched pixels into the frame and clears their marks. 
+  void CollectFrame(Workspace *ws, FilteredFrame *out);
+
+  // Filters the frames of the block, safe to run on several threads.
+  void FilterBlock(xpcs::io::ImmBlock* blk, FilteredFrame *out);
+
+  void AppendTimestamps(xpcs::io::ImmBlock* blk);
+
+  // Appends the filtered values as the next frame. 
+  void AppendFrame(const FilteredFrame &frame);
+
   xpcs::data_structure::SparseData *data_;
 
+  xpcs::CorrStream *stream_;
+
   short *pixel_mask_;
 
   int *sbin_mask_;
 
-  short *sparse_map_;
+  // One per OpenMP thread. 
+  std::vector<Workspace*> workspaces_;
 
-  float *pixels_value_;
+  // Filtered blocks of the current batch. 
+  std::vector<FilteredFrame> filtered_;
 
   float *pixels_sum_;
 
@@ -70,28 +70,9 @@ Stride::~Stride() {
 }
 
 void Stride::Apply(struct xpcs::io::ImmBlock* blk) {
-  int **indx = blk->index;
-  float **val = blk->value;
-  int frames = blk->frames;
-  std::vector<int> ppf = blk->pixels_per_frame;
-
-  int pixels = ppf[0];
-
-  int **new_index = new int*[1];
-  new_index[0] = indx[0];
-
-  float **new_val = new float*[1];
-  new_val[0] = val[0];
-
-  int new_frames = 1;
-  std::vector<int> new_ppf = {pixels};
-
-  blk->index = new_index;
-  blk->value = new_val;
-  blk->frames = new_frames;
-  blk->pixels_per_frame = new_ppf;
-
-  //TODO smart pointers to handle memory
+  // Only the first frame is kept, the pointer arrays already start with it.
+  blk->frames = 1;
+  blk->pixels_per_frame.resize(1);
 }
 
 
@@ -104,7 +104,7 @@ Eigen::MatrixXf Funcs::partitionMean(Eigen::Ref<Eigen::MatrixXf> pixelSum)
 
     float normFactor = conf->getNormFactor();
 
-    map<int, map<int, vector<int>> > qbins = conf->getBinMaps();
+    const map<int, map<int, vector<int>> >& qbins = conf->getBinMaps();
 
     Eigen::MatrixXf means(totalStaticPartns, partitions+1);
     means.setZero(totalStaticPartns, partitions+1);
@@ -0,0 +1,247 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#include "g2_normalizer.h"
+
+#include <math.h>
+#include <cmath>
+#include <algorithm>
+
+#include <omp.h>
+
+#include "Eigen/Dense"
+
+#include "configuration.h"
+#include "h5_result.h"
+
+namespace xpcs {
+
+using std::vector;
+
+G2Normalizer::G2Normalizer(int taus) : 
+    bins_(Configuration::instance()->getBinTable()), taus_(taus), max_qbin_(0)
+{
+    int qbins = bins_.qbins.size();
+    int sbins = bins_.sbins.size();
+
+    for (int i = 0; i < qbins; i++)
+        max_qbin_ = std::max(max_qbin_, bins_.qbins[i]);
+
+    pixel_sbin_.resize(bins_.pixels.size());
+    for (int j = 0; j < sbins; j++) {
+        for (int k = bins_.sbin_offsets[j]; k < bins_.sbin_offsets[j+1]; k++)
+            pixel_sbin_[k] = j;
+    }
+
+    long sbin_size = (long)sbins * taus_;
+    long qbin_size = (long)qbins * taus_;
+
+    g2_sums_ = new float[sbin_size];
+    ip_sums_ = new float[sbin_size];
+    if_sums_ = new float[sbin_size];
+    sbin_counts_ = new int[sbins];
+
+    for (long i = 0; i < sbin_size; i++) {
+        g2_sums_[i] = 0.0f;
+        ip_sums_[i] = 0.0f;
+        if_sums_[i] = 0.0f;
+    }
+
+    for (int i = 0; i < sbins; i++)
+        sbin_counts_[i] = 0;
+
+    avg_ = new float[qbin_size];
+    std_ = new float[qbin_size];
+    samples_ = new float[qbin_size];
+
+    for (long i = 0; i < qbin_size; i++) {
+        avg_[i] = 0.0f;
+        std_[i] = 0.0f;
+        samples_[i] = 0.0f;
+    }
+}
+
+G2Normalizer::~G2Normalizer()
+{
+    delete [] g2_sums_;
+    delete [] ip_sums_;
+    delete [] if_sums_;
+    delete [] sbin_counts_;
+    delete [] avg_;
+    delete [] std_;
+    delete [] samples_;
+}
+
+const vector<int>& G2Normalizer::Pixels()
+{
+    return bins_.pixels;
+}
+
+int G2Normalizer::QBins()
+{
+    return bins_.qbins.size();
+}
+
+int G2Normalizer::QBinBegin(int i)
+{
+    return bins_.sbin_offsets[bins_.qbin_offsets[i]];
+}
+
+int G2Normalizer::QBinEnd(int i)
+{
+    return bins_.sbin_offsets[bins_.qbin_offsets[i+1]];
+}
+
+void G2Normalizer::Add(int begin, int end, 
+                       const float* g2, 
+                       const float* ip, 
+                       const float* iff, 
+                       const int* rows, 
+                       long row_stride, 
+                       long tau_stride)
+{
+    if (begin >= end) return;
+
+    // All the positions belong to the q-bin of the first one. 
+    int q = std::upper_bound(bins_.qbin_offsets.begin(), bins_.qbin_offsets.end(), 
+                             pixel_sbin_[begin]) - bins_.qbin_offsets.begin() - 1;
+
+    float *avg = avg_ + (long)q * taus_;
+    float *std = std_ + (long)q * taus_;
+    float *samples = samples_ + (long)q * taus_;
+
+    // Every delay is an independent reduction over the positions, walking 
+    // the positions for one delay at a time reads the inputs contiguously 
+    // when they are column-major. 
+    for (int t = 0; t < taus_; t++) {
+        long toffset = t * tau_stride;
+
+        for (int k = begin; k < end; k++) {
+            long offset = rows[k - begin] * row_stride + toffset;
+            float g2v = g2[offset];
+            float ipv = ip[offset];
+            float ifv = iff[offset];
+
+            long soffset = (long)pixel_sbin_[k] * taus_ + t;
+            g2_sums_[soffset] += g2v;
+            ip_sums_[soffset] += ipv;
+            if_sums_[soffset] += ifv;
+
+            // Running mean and variance of the normalized G2 of the q-bin. 
+            float prev = avg[t];
+            float normalized = g2v / (ipv * ifv);
+
+            samples[t] += 1.0f;
+            if (std::isnan(normalized)) normalized = 0.0f;
+            samples[t] += 1.0f;
+
+            float delta = (normalized - prev) / samples[t];
+            if (std::isnan(delta)) delta = 0.0f;
+
+            avg[t] += delta;
+            std[t] += (normalized - prev) * (normalized - avg[t]);
+        }
+    }
+
+    for (int k = begin; k < end; k++)
+        sbin_counts_[pixel_sbin_[k]]++;
+}
+
+void G2Normalizer::Write()
+{
+    Configuration* conf = Configuration::instance();
+
+    Eigen::MatrixXf g2(max_qbin_, taus_);
+    Eigen::MatrixXf stdError(max_qbin_, taus_);
+
+    g2.setZero();
+    stdError.setZero();
+
+    int qbins = bins_.qbins.size();
+
+    #pragma omp parallel for schedule(dynamic) default(none) shared(g2, stdError, qbins)
+    for (int i = 0; i < qbins; i++) {
+        int q = bins_.qbins[i] - 1;
+
+        vector<float> g2row(taus_, 0.0f);
+        vector<float> counts(taus_, 0.0f);
+
+        // Average of each static partition, normalized by its IP and IF. 
+        for (int j = bins_.qbin_offsets[i]; j < bins_.qbin_offsets[i+1]; j++) {
+            long offset = (long)j * taus_;
+            float count = sbin_counts_[j];
+
+            for (int t = 0; t < taus_; t++) {
+                float g2v = g2_sums_[offset + t] / count;
+                float ipv = ip_sums_[offset + t] / count;
+                float ifv = if_sums_[offset + t] / count;
+
+                g2v = g2v / (ipv * ifv);
+
+                if (!std::isnan(g2v)) {
+                    g2row[t] += g2v;
+                    counts[t] += 1.0f;
+                }
+            }
+        }
+
+        // Mean across the static partitions, and the standard error. 
+        long offset = (long)i * taus_;
+        for (int t = 0; t < taus_; t++) {
+            float stdNorm = std_[offset + t] / samples_[offset + t];
+            float inv = 1.0f / samples_[offset + t];
+
+            g2(q, t) = g2row[t] / counts[t];
+            stdError(q, t) = sqrtf(inv) * sqrtf(stdNorm);
+        }
+    }
+
+    H5Result::write2DData(conf->getFilename(), conf->OutputPath(), "norm-0-g2", g2);
+    H5Result::write2DData(conf->getFilename(), conf->OutputPath(), "norm-0-stderr", stdError);
+}
+
+} // namespace xpcs
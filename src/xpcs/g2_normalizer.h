@@ -0,0 +1,128 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#ifndef XPCS_G2_NORMALIZER_H
+#define XPCS_G2_NORMALIZER_H
+
+#include <vector>
+
+namespace xpcs {
+
+struct BinTable;
+
+/**
+ * Reduces per-pixel G2, IP and IF into the static partition sums and the
+ * per q-bin standard error, and writes the normalized g2 (norm-0-g2 and 
+ * norm-0-stderr). Pixels are added by their position in the flat bin table
+ * of the Configuration, so the per-pixel values never need to exist all at
+ * once. 
+ */
+class G2Normalizer {
+
+public:
+
+  G2Normalizer(int taus);
+
+  ~G2Normalizer();
+
+  // Pixels of all the q-bins, ordered by q-bin, s-bin and pixel. 
+  const std::vector<int>& Pixels();
+
+  // Number of q-bins and the range of positions of the i-th q-bin. 
+  int QBins();
+
+  int QBinBegin(int i);
+
+  int QBinEnd(int i);
+
+  // Add the positions begin .. end-1 of one q-bin. The value of the delay t
+  // of position k is at g2[rows[k - begin] * row_stride + t * tau_stride]. 
+  // The positions of a q-bin have to be added in ascending order, different
+  // q-bins can be added concurrently. 
+  void Add(int begin, int end, 
+           const float* g2, 
+           const float* ip, 
+           const float* iff, 
+           const int* rows, 
+           long row_stride, 
+           long tau_stride);
+
+  // Normalize the static partitions and write the results. 
+  void Write();
+
+private:
+
+  const BinTable& bins_;
+
+  int taus_;
+
+  int max_qbin_;
+
+  // Index of the s-bin in the bin table of every position. 
+  std::vector<int> pixel_sbin_;
+
+  // Static partition sums, indexed by the s-bin in the bin table. 
+  float *g2_sums_;
+
+  float *ip_sums_;
+
+  float *if_sums_;
+
+  int *sbin_counts_;
+
+  // Running mean and variance of the normalized G2, indexed by the q-bin 
+  // in the bin table. 
+  float *avg_;
+
+  float *std_;
+
+  float *samples_;
+};
+
+} // namespace xpcs
+
+#endif
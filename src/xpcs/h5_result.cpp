@@ -47,17 +47,83 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "h5_result.h"
 
+#include <algorithm>
+
 #include "hdf5.h"
 
 #include "configuration.h"
+#include "h5_writer.h"
 
 namespace xpcs {
 
+// Datasets of fewer elements are never chunked. 
+static const hsize_t kChunkMinElements = 1 << 16;
+
+// Elements per chunk, at most kChunkColumns of them along the last dimension. 
+static const hsize_t kChunkElements = 1 << 16;
+static const hsize_t kChunkColumns = 1024;
+
+H5Layout H5Result::layout_ = { 0, true, 0 };
+
+void H5Result::setLayout(const H5Layout &layout)
+{
+    layout_ = layout;
+}
+
+hid_t H5Result::datasetProperties(int rank, const hsize_t *dims, bool block)
+{
+    hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+
+    // Blocks that are never written have to read back as zeros. 
+    if (block) {
+        float fill = 0.0f;
+        H5Pset_fill_value(dcpl_id, H5T_NATIVE_FLOAT, &fill);
+        H5Pset_fill_time(dcpl_id, H5D_FILL_TIME_ALLOC);
+    }
+
+    hsize_t elements = 1;
+    for (int i = 0; i < rank; i++)
+        elements *= dims[i];
+
+    bool deflate = layout_.deflate > 0 && H5Zfilter_avail(H5Z_FILTER_DEFLATE) > 0;
+    bool scale = block && layout_.scale_digits > 0;
+
+    // Filters need a chunked layout, without them everything stays contiguous.
+    if ((!deflate && !scale) || elements < kChunkMinElements)
+        return dcpl_id;
+
+    hsize_t chunk[3];
+    hsize_t remaining = kChunkElements;
+    for (int i = rank - 1; i >= 0; i--) {
+        chunk[i] = std::min(dims[i], i == rank - 1 ? kChunkColumns : remaining);
+        remaining = std::max((hsize_t)1, remaining / chunk[i]);
+    }
+
+    H5Pset_chunk(dcpl_id, rank, chunk);
+
+    // Scale-offset keeps scale_digits decimal digits, shuffling its packed 
+    // output gains nothing. 
+    if (scale)
+        H5Pset_scaleoffset(dcpl_id, H5Z_SO_FLOAT_DSCALE, layout_.scale_digits);
+    else if (layout_.shuffle)
+        H5Pset_shuffle(dcpl_id);
+
+    if (deflate)
+        H5Pset_deflate(dcpl_id, layout_.deflate);
+
+    return dcpl_id;
+}
+
 void H5Result::write2DData(const std::string &file, 
                            const std::string &grpname,
                            const std::string &nodename,
                            Eigen::Ref<Eigen::MatrixXf> mat)
 {
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        int sizes[2] = {(int)mat.cols(), (int)mat.rows()};
+        writer->Write(grpname, nodename, 2, sizes, mat.data());
+        return;
+    }
     hid_t file_id, exchange_grp_id, dataset_id, dataspace_id;
     hsize_t dims[2];
 
@@ -79,7 +145,9 @@ void H5Result::write2DData(const std::string &file,
         dims[1] = mat.rows();
 
         dataspace_id = H5Screate_simple(2, dims, NULL);
-        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dcpl_id = datasetProperties(2, dims, false);
+        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+        H5Pclose(dcpl_id);
     }
 
     hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, mat.data());
@@ -97,6 +165,11 @@ void H5Result::write2DData(const std::string &file,
                            int size1,
                            float* data)
 {
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        int sizes[2] = {size0, size1};
+        writer->Write(grpname, nodename, 2, sizes, data);
+        return;
+    }
     hid_t file_id, exchange_grp_id, dataset_id, dataspace_id;
     hsize_t dims[2];
 
@@ -118,7 +191,9 @@ void H5Result::write2DData(const std::string &file,
         dims[1] = size1;
 
         dataspace_id = H5Screate_simple(2, dims, NULL);
-        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dcpl_id = datasetProperties(2, dims, false);
+        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+        H5Pclose(dcpl_id);
     }
 
     hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
@@ -129,6 +204,69 @@ void H5Result::write2DData(const std::string &file,
     H5Fclose(file_id);    
 }
 
+void H5Result::write2DBlock(const std::string &file, 
+                            const std::string &grpname,
+                            const std::string &nodename,
+                            int size0,
+                            int size1,
+                            int offset0,
+                            int offset1,
+                            int count0,
+                            int count1,
+                            float* data)
+{
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        writer->WriteBlock(grpname, nodename, size0, size1, offset0, offset1, count0, count1, data);
+        return;
+    }
+    hid_t file_id, exchange_grp_id, dataset_id, dataspace_id, memspace_id;
+    hsize_t dims[2];
+    hsize_t start[2];
+    hsize_t count[2];
+
+    file_id = H5Fopen(file.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+    // Disable hdf std err printout for opening an non-existing group.
+    H5Eset_auto(H5E_DEFAULT, NULL, NULL);
+    exchange_grp_id = H5Gopen2(file_id, grpname.c_str(), H5P_DEFAULT);
+    if (exchange_grp_id < 0) {
+        exchange_grp_id = H5Gcreate(file_id, grpname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    }
+
+    //TODO :: Log error if the grp creation fail. 
+
+    dataset_id = H5Dopen2(exchange_grp_id, nodename.c_str(), H5P_DEFAULT);
+
+    if (dataset_id < 0) {
+
+        dims[0] = size0;
+        dims[1] = size1;
+
+        hid_t dcpl_id = datasetProperties(2, dims, true);
+
+        dataspace_id = H5Screate_simple(2, dims, NULL);
+        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+
+        H5Sclose(dataspace_id);
+        H5Pclose(dcpl_id);
+    }
+
+    start[0] = offset0;
+    start[1] = offset1;
+    count[0] = count0;
+    count[1] = count1;
+
+    dataspace_id = H5Dget_space(dataset_id);
+    H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET, start, NULL, count, NULL);
+    memspace_id = H5Screate_simple(2, count, NULL);
+
+    hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, memspace_id, dataspace_id, H5P_DEFAULT, data);
+
+    H5Sclose(memspace_id);
+    H5Sclose(dataspace_id);
+    H5Dclose(dataset_id);
+    H5Gclose(exchange_grp_id);
+    H5Fclose(file_id);    
+}
 
 void H5Result::write3DData(const std::string &file, 
                            const std::string &grpname,
@@ -138,6 +276,11 @@ void H5Result::write3DData(const std::string &file,
                            int size2,
                            float* data)
 {
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        int sizes[3] = {size0, size1, size2};
+        writer->Write(grpname, nodename, 3, sizes, data);
+        return;
+    }
     hid_t file_id, exchange_grp_id, dataset_id, dataspace_id;
     hsize_t dims[3];
     hsize_t start_3d[3];
@@ -179,7 +322,9 @@ void H5Result::write3DData(const std::string &file,
 
         H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET, start_3d, stride_3d, count_3d, NULL);
 
-        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dcpl_id = datasetProperties(3, dims, false);
+        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+        H5Pclose(dcpl_id);
     }
 
     hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
@@ -198,6 +343,11 @@ void H5Result::write2DData(const std::string &file,
                            int size1,
                            double* data)
 {
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        int sizes[2] = {size0, size1};
+        writer->Write(grpname, nodename, 2, sizes, data);
+        return;
+    }
     hid_t file_id, exchange_grp_id, dataset_id, dataspace_id;
     hsize_t dims[2];
 
@@ -219,7 +369,9 @@ void H5Result::write2DData(const std::string &file,
         dims[1] = size1;
 
         dataspace_id = H5Screate_simple(2, dims, NULL);
-        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_DOUBLE, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dcpl_id = datasetProperties(2, dims, false);
+        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_DOUBLE, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+        H5Pclose(dcpl_id);
     }
 
     hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
@@ -238,6 +390,11 @@ void H5Result::write1DData(const std::string &file,
                            const std::string &nodename,
                            Eigen::Ref<Eigen::VectorXf> vec)
 {
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        int sizes[2] = {1, (int)vec.rows()};
+        writer->Write(grpname, nodename, 2, sizes, vec.data());
+        return;
+    }
     hid_t file_id, exchange_grp_id, dataset_id, dataspace_id;
     hsize_t dims[2];
 
@@ -259,7 +416,9 @@ void H5Result::write1DData(const std::string &file,
         dims[1] = vec.rows();
 
         dataspace_id = H5Screate_simple(2, dims, NULL);
-        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dcpl_id = datasetProperties(2, dims, false);
+        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+        H5Pclose(dcpl_id);
     }
 
     hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, vec.data());
@@ -277,6 +436,11 @@ void H5Result::write1DData(const std::string &file,
                            int size,
                            float* data)
 {
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        int sizes[2] = {1, size};
+        writer->Write(grpname, nodename, 2, sizes, data);
+        return;
+    }
     hid_t file_id, exchange_grp_id, dataset_id, dataspace_id;
     hsize_t dims[2];
 
@@ -298,7 +462,9 @@ void H5Result::write1DData(const std::string &file,
         dims[1] = size;
 
         dataspace_id = H5Screate_simple(2, dims, NULL);
-        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dcpl_id = datasetProperties(2, dims, false);
+        dataset_id = H5Dcreate(exchange_grp_id, nodename.c_str(), H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+        H5Pclose(dcpl_id);
     }
 
     hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
@@ -314,6 +480,13 @@ void H5Result::writePixelSum(const std::string &file,
                    const std::string &grpname,
                    Eigen::Ref<Eigen::VectorXf> pixelSum) {
 
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        Configuration *conf = Configuration::instance();
+        int sizes[2] = {conf->getFrameHeight(), conf->getFrameWidth()};
+        writer->Write(grpname, "pixelSum", 2, sizes, pixelSum.data());
+        return;
+    }
+
     hid_t file_id, exchange_grp_id, dataset_id, dataspace_id;
     hsize_t dims[2];
 
@@ -338,7 +511,9 @@ void H5Result::writePixelSum(const std::string &file,
         dims[1] = w;
 
         dataspace_id = H5Screate_simple(2, dims, NULL);
-        dataset_id = H5Dcreate(exchange_grp_id, "pixelSum", H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dcpl_id = datasetProperties(2, dims, false);
+        dataset_id = H5Dcreate(exchange_grp_id, "pixelSum", H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+        H5Pclose(dcpl_id);
     }
 
     hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, pixelSum.data());
@@ -354,6 +529,12 @@ void H5Result::writeFrameSum(const std::string &file,
                    const std::string &grpname,
                    Eigen::Ref<Eigen::VectorXf> frameSum) {
 
+    if (H5Writer* writer = H5Writer::Active(file)) {
+        int sizes[2] = {1, Configuration::instance()->getFrameTodoCount()};
+        writer->Write(grpname, "frameSum", 2, sizes, frameSum.data());
+        return;
+    }
+
     hid_t file_id, exchange_grp_id, dataset_id, dataspace_id;
     hsize_t dims[2];
 
@@ -376,7 +557,9 @@ void H5Result::writeFrameSum(const std::string &file,
         dims[1] = conf->getFrameTodoCount();
 
         dataspace_id = H5Screate_simple(2, dims, NULL);
-        dataset_id = H5Dcreate(exchange_grp_id, "frameSum", H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+        hid_t dcpl_id = datasetProperties(2, dims, false);
+        dataset_id = H5Dcreate(exchange_grp_id, "frameSum", H5T_NATIVE_FLOAT, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+        H5Pclose(dcpl_id);
     }
 
     hid_t stats = H5Dwrite(dataset_id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, frameSum.data());
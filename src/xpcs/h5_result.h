@@ -50,11 +50,30 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "Eigen/Dense"
 #include "Eigen/SparseCore"
 
+#include "hdf5.h"
+
 namespace xpcs {
 
+/**
+ * Storage of the larger result datasets. With deflate (a zlib level 1-9) or
+ * scale_digits set they are chunked, shuffled if requested and compressed.
+ * scale_digits > 0 stores the two-time blocks lossy with that many decimal 
+ * digits via the scale-offset filter. Small datasets stay contiguous. 
+ */
+struct H5Layout {
+  int deflate;
+  bool shuffle;
+  int scale_digits;
+};
+
 class H5Result {
 
 public:
+    static void setLayout(const H5Layout &layout);
+
+    // Creation properties of a new dataset, the caller closes them. 
+    static hid_t datasetProperties(int rank, const hsize_t *dims, bool block);
+
     static void write2DData(const std::string &file, 
                         const std::string &grpname,
                         const std::string &nodename,
@@ -86,6 +105,22 @@ public:
                         double* data);
 
 
+    /**
+     * Write a count0 x count1 block at (offset0, offset1) of a size0 x size1 
+     * dataset, which is created on the first call. Parts of the dataset that
+     * are never written read back as zeros. 
+     */
+    static void write2DBlock(const std::string &file, 
+                        const std::string &grpname,
+                        const std::string &nodename,
+                        int size0,
+                        int size1,
+                        int offset0,
+                        int offset1,
+                        int count0,
+                        int count1,
+                        float* data);
+
     static void write3DData(const std::string &file, 
                         const std::string &grpname,
                         const std::string &nodename,
@@ -101,6 +136,9 @@ public:
     static void writeFrameSum(const std::string &file, 
                               const std::string &grpname,
                               Eigen::Ref<Eigen::VectorXf> frameSum);
+
+private:
+    static H5Layout layout_;
 };
 
 }
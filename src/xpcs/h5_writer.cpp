@@ -0,0 +1,296 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#include "h5_writer.h"
+
+#include <string.h>
+
+#include "h5_result.h"
+
+namespace xpcs {
+
+// Bytes of data that may wait in the queue before Write() blocks. 
+static const size_t kMaxQueuedBytes = 256UL << 20;
+
+H5Writer* H5Writer::active_ = NULL;
+
+H5Writer::H5Writer(const std::string &file) : file_(file), queued_bytes_(0), busy_(false), stop_(false)
+{
+    // Disable hdf std err printout for opening an non-existing group.
+    H5Eset_auto(H5E_DEFAULT, NULL, NULL);
+    file_id_ = H5Fopen(file.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+
+    // Without the file H5Result keeps writing on its own. 
+    if (file_id_ < 0) return;
+
+    active_ = this;
+    thread_ = std::thread(&H5Writer::Run, this);
+}
+
+H5Writer::~H5Writer() {
+    Close();
+}
+
+H5Writer* H5Writer::Active(const std::string &file) {
+    if (active_ && active_->file_ == file) return active_;
+
+    return NULL;
+}
+
+void H5Writer::Write(const std::string &grpname, 
+                     const std::string &nodename,
+                     int rank,
+                     const int *dims,
+                     const float *data)
+{
+    Job* job = new Job();
+    job->grpname = grpname;
+    job->nodename = nodename;
+    job->is_double = false;
+    job->block = false;
+    job->rank = rank;
+
+    size_t size = 1;
+    for (int i = 0; i < rank; i++) {
+        job->dims[i] = dims[i];
+        size *= dims[i];
+    }
+
+    Push(job, data, size * sizeof(float));
+}
+
+void H5Writer::Write(const std::string &grpname, 
+                     const std::string &nodename,
+                     int rank,
+                     const int *dims,
+                     const double *data)
+{
+    Job* job = new Job();
+    job->grpname = grpname;
+    job->nodename = nodename;
+    job->is_double = true;
+    job->block = false;
+    job->rank = rank;
+
+    size_t size = 1;
+    for (int i = 0; i < rank; i++) {
+        job->dims[i] = dims[i];
+        size *= dims[i];
+    }
+
+    Push(job, data, size * sizeof(double));
+}
+
+void H5Writer::WriteBlock(const std::string &grpname, 
+                          const std::string &nodename,
+                          int size0,
+                          int size1,
+                          int offset0,
+                          int offset1,
+                          int count0,
+                          int count1,
+                          const float *data)
+{
+    Job* job = new Job();
+    job->grpname = grpname;
+    job->nodename = nodename;
+    job->is_double = false;
+    job->block = true;
+    job->rank = 2;
+    job->dims[0] = size0;
+    job->dims[1] = size1;
+    job->start[0] = offset0;
+    job->start[1] = offset1;
+    job->count[0] = count0;
+    job->count[1] = count1;
+
+    Push(job, data, (size_t)count0 * count1 * sizeof(float));
+}
+
+void H5Writer::Push(Job* job, const void *data, size_t bytes) {
+    if (bytes > kMaxQueuedBytes) {
+        // Written in order after the queue, straight from the caller.
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return queue_.empty() && !busy_; });
+        busy_ = true;
+        lock.unlock();
+
+        Execute(job, data);
+        delete job;
+
+        lock.lock();
+        busy_ = false;
+        not_empty_.notify_one();
+        idle_.notify_all();
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this, bytes] { 
+            return queued_bytes_ + bytes <= kMaxQueuedBytes; 
+        });
+        queued_bytes_ += bytes;
+    }
+
+    job->data.resize(bytes);
+    if (bytes) memcpy(&job->data[0], data, bytes);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(job);
+    not_empty_.notify_one();
+}
+
+void H5Writer::Close() {
+    if (!thread_.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    not_empty_.notify_one();
+    thread_.join();
+
+    for (std::map<std::string, hid_t>::iterator it = datasets_.begin(); it != datasets_.end(); it++)
+        H5Dclose(it->second);
+
+    for (std::map<std::string, hid_t>::iterator it = groups_.begin(); it != groups_.end(); it++)
+        H5Gclose(it->second);
+
+    datasets_.clear();
+    groups_.clear();
+
+    H5Fclose(file_id_);
+
+    if (active_ == this) active_ = NULL;
+}
+
+void H5Writer::Run() {
+    while (true) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            // Not while a large write is done by its caller. 
+            not_empty_.wait(lock, [this] { return !busy_ && (!queue_.empty() || stop_); });
+
+            // Only stops once everything queued is written. 
+            if (queue_.empty()) break;
+
+            job = queue_.front();
+            queue_.pop_front();
+            busy_ = true;
+        }
+
+        Execute(job, job->data.empty() ? NULL : &job->data[0]);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_bytes_ -= job->data.size();
+            busy_ = false;
+            not_full_.notify_all();
+            if (queue_.empty()) idle_.notify_all();
+        }
+
+        delete job;
+    }
+}
+
+void H5Writer::Execute(Job* job, const void *data) {
+    hid_t dataset_id = Dataset(job);
+    hid_t type = job->is_double ? H5T_NATIVE_DOUBLE : H5T_NATIVE_FLOAT;
+
+    if (job->block) {
+        hid_t dataspace_id = H5Dget_space(dataset_id);
+        H5Sselect_hyperslab(dataspace_id, H5S_SELECT_SET, job->start, NULL, job->count, NULL);
+        hid_t memspace_id = H5Screate_simple(2, job->count, NULL);
+
+        H5Dwrite(dataset_id, type, memspace_id, dataspace_id, H5P_DEFAULT, data);
+
+        H5Sclose(memspace_id);
+        H5Sclose(dataspace_id);
+    } else {
+        H5Dwrite(dataset_id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT, data);
+    }
+}
+
+hid_t H5Writer::Group(const std::string &grpname) {
+    std::map<std::string, hid_t>::iterator it = groups_.find(grpname);
+    if (it != groups_.end()) return it->second;
+
+    hid_t grp_id = H5Gopen2(file_id_, grpname.c_str(), H5P_DEFAULT);
+    if (grp_id < 0) {
+        grp_id = H5Gcreate(file_id_, grpname.c_str(), H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    }
+
+    groups_[grpname] = grp_id;
+    return grp_id;
+}
+
+hid_t H5Writer::Dataset(Job* job) {
+    std::string key = job->grpname + "/" + job->nodename;
+    std::map<std::string, hid_t>::iterator it = datasets_.find(key);
+    if (it != datasets_.end()) return it->second;
+
+    hid_t grp_id = Group(job->grpname);
+    hid_t dataset_id = H5Dopen2(grp_id, job->nodename.c_str(), H5P_DEFAULT);
+
+    if (dataset_id < 0) {
+        hid_t type = job->is_double ? H5T_NATIVE_DOUBLE : H5T_NATIVE_FLOAT;
+        hid_t dcpl_id = H5Result::datasetProperties(job->rank, job->dims, job->block);
+
+        hid_t dataspace_id = H5Screate_simple(job->rank, job->dims, NULL);
+        dataset_id = H5Dcreate(grp_id, job->nodename.c_str(), type, dataspace_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+
+        H5Sclose(dataspace_id);
+        H5Pclose(dcpl_id);
+    }
+
+    datasets_[key] = dataset_id;
+    return dataset_id;
+}
+
+} //namespace xpcs
@@ -0,0 +1,157 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#ifndef XPCS_H5_WRITER_H
+#define XPCS_H5_WRITER_H
+
+#include <map>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "hdf5.h"
+
+namespace xpcs {
+
+/**
+ * Writes result datasets into an HDF5 file that is opened once and kept 
+ * open. Every write is queued with a copy of its data and done on a 
+ * background thread, so the caller may reuse its buffers right away. At 
+ * most kMaxQueuedBytes are queued, further writes wait for the thread. A 
+ * write larger than that is done from the caller's buffer once the queue 
+ * is written, so the largest results are never held twice. 
+ * 
+ * While a writer is open H5Result hands all writes to its file over to it, 
+ * Close() waits until they are in the file and closes it. 
+ */
+class H5Writer {
+
+public:
+
+  H5Writer(const std::string &file);
+
+  ~H5Writer();
+
+  // The open writer of `file`, NULL if there is none. 
+  static H5Writer* Active(const std::string &file);
+
+  void Write(const std::string &grpname, 
+             const std::string &nodename,
+             int rank,
+             const int *dims,
+             const float *data);
+
+  void Write(const std::string &grpname, 
+             const std::string &nodename,
+             int rank,
+             const int *dims,
+             const double *data);
+
+  // Block of a 2D dataset, see H5Result::write2DBlock. 
+  void WriteBlock(const std::string &grpname, 
+                  const std::string &nodename,
+                  int size0,
+                  int size1,
+                  int offset0,
+                  int offset1,
+                  int count0,
+                  int count1,
+                  const float *data);
+
+  void Close();
+
+private:
+
+  struct Job {
+    std::string grpname;
+    std::string nodename;
+    bool is_double;
+    bool block;
+    int rank;
+    hsize_t dims[3];
+    hsize_t start[2];
+    hsize_t count[2];
+    std::vector<char> data;
+  };
+
+  void Push(Job* job, const void *data, size_t bytes);
+
+  void Run();
+
+  void Execute(Job* job, const void *data);
+
+  hid_t Group(const std::string &grpname);
+
+  hid_t Dataset(Job* job);
+
+  static H5Writer* active_;
+
+  std::string file_;
+  hid_t file_id_;
+
+  std::map<std::string, hid_t> groups_;
+  std::map<std::string, hid_t> datasets_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+  std::condition_variable idle_;
+
+  std::deque<Job*> queue_;
+  size_t queued_bytes_;
+  // A job is being written, by the thread or by the caller of a large one.
+  bool busy_;
+  bool stop_;
+};
+
+} //namespace xpcs
+
+#endif
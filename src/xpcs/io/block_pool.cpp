@@ -0,0 +1,161 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#include "block_pool.h"
+
+#include <algorithm>
+
+namespace xpcs {
+namespace io {
+
+int* ImmBlock::IndexBuffer(int frame, int pixels) {
+    if ((int) index_buf.size() <= frame)
+        index_buf.resize(frame + 1);
+
+    std::vector<int>& buf = index_buf[frame];
+    if ((int) buf.size() < pixels || buf.empty())
+        buf.resize(std::max(pixels, 1));
+
+    index[frame] = &buf[0];
+    return index[frame];
+}
+
+float* ImmBlock::ValueBuffer(int frame, int pixels) {
+    if ((int) value_buf.size() <= frame)
+        value_buf.resize(frame + 1);
+
+    std::vector<float>& buf = value_buf[frame];
+    if ((int) buf.size() < pixels || buf.empty())
+        buf.resize(std::max(pixels, 1));
+
+    value[frame] = &buf[0];
+    return value[frame];
+}
+
+short* ImmBlock::Value16Buffer(int frame, int pixels) {
+    if ((int) value16_buf.size() <= frame)
+        value16_buf.resize(frame + 1);
+
+    std::vector<short>& buf = value16_buf[frame];
+    if ((int) buf.size() < pixels || buf.empty())
+        buf.resize(std::max(pixels, 1));
+
+    value16[frame] = &buf[0];
+    return value16[frame];
+}
+
+void ImmBlock::Borrow(ImmBlock* source) {
+    // Consecutive frames mostly come from the same source. 
+    if (!sources.empty() && sources.back() == source) return;
+
+    source->refs++;
+    sources.push_back(source);
+}
+
+void ImmBlock::Release() {
+    if (--refs > 0) return;
+
+    for (size_t i = 0; i < sources.size(); i++)
+        sources[i]->Release();
+    sources.clear();
+
+    pool->Recycle(this);
+}
+
+BlockPool::BlockPool() {
+
+}
+
+BlockPool::~BlockPool() {
+    for (size_t i = 0; i < free_.size(); i++)
+        delete free_[i];
+}
+
+ImmBlock* BlockPool::Acquire(int frames, bool value, bool value16) {
+    ImmBlock *blk = NULL;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!free_.empty()) {
+            blk = free_.back();
+            free_.pop_back();
+        }
+    }
+
+    if (blk == NULL) {
+        blk = new ImmBlock;
+        blk->pool = this;
+    }
+
+    if ((int) blk->index_ptr.size() < frames || blk->index_ptr.empty()) {
+        int n = std::max(frames, 1);
+        blk->index_ptr.resize(n);
+        blk->value_ptr.resize(n);
+        blk->value16_ptr.resize(n);
+        blk->clock_buf.resize(n);
+        blk->ticks_buf.resize(n);
+    }
+
+    blk->index = &blk->index_ptr[0];
+    blk->value = value ? &blk->value_ptr[0] : NULL;
+    blk->value16 = value16 ? &blk->value16_ptr[0] : NULL;
+    blk->clock = &blk->clock_buf[0];
+    blk->ticks = &blk->ticks_buf[0];
+    blk->frames = frames;
+    blk->id = 0;
+    blk->pixels_per_frame.clear();
+    blk->refs = 1;
+
+    return blk;
+}
+
+void BlockPool::Recycle(ImmBlock* blk) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(blk);
+}
+
+} // namespace io
+} // namespace xpcs
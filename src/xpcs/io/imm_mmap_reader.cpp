@@ -0,0 +1,225 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+#include "imm_mmap_reader.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+namespace xpcs {
+namespace io {
+
+static const char kIndexMagic[8] = {'I', 'M', 'M', 'I', 'D', 'X', '1', '\0'};
+
+ImmMmapReader::ImmMmapReader(const std::string& filename, bool cache_index) :
+    data_(NULL), size_(0), mtime_(0), fd_(-1), frame_(0), compression_(false)
+{
+    // On failure the reader is left without frames. 
+    fd_ = open(filename.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        spdlog::get("console")->error("IMM: cannot open {}: {}", filename, strerror(errno));
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+        spdlog::get("console")->error("IMM: cannot stat {}: {}", filename, strerror(errno));
+        return;
+    }
+    size_ = st.st_size;
+    mtime_ = st.st_mtime;
+
+    if (size_ < ImmHeader::header_size) {
+        spdlog::get("console")->error("IMM: {} is too short for a frame header ({} bytes)", filename, size_);
+        return;
+    }
+
+    void *addr = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (addr == MAP_FAILED) {
+        spdlog::get("console")->error("IMM: cannot map {}: {}", filename, strerror(errno));
+        return;
+    }
+
+    data_ = (const char*) addr;
+    madvise(addr, size_, MADV_SEQUENTIAL);
+
+    const ImmHeader *header = (const ImmHeader*) data_;
+    compression_ = header->compression != 0 ? true : false;
+
+    std::string index_path = filename + ".idx";
+    if (!cache_index || !LoadIndex(index_path)) {
+        BuildIndex();
+        if (cache_index) SaveIndex(index_path);
+    }
+}
+
+ImmMmapReader::~ImmMmapReader() {
+    if (data_) munmap((void*) data_, size_);
+    if (fd_ >= 0) close(fd_);
+}
+
+void ImmMmapReader::BuildIndex() {
+    int image_bytes = compression_ ? 6 : 2;
+    uint64_t offset = 0;
+
+    while (offset + ImmHeader::header_size <= size_) {
+        const ImmHeader *header = (const ImmHeader*) (data_ + offset);
+        uint64_t next = offset + ImmHeader::header_size + (uint64_t) header->dlen * image_bytes;
+        if (next > size_) break;
+
+        offsets_.push_back(offset);
+        offset = next;
+    }
+}
+
+bool ImmMmapReader::LoadIndex(const std::string& path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == NULL) return false;
+
+    char magic[8];
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t frames = 0;
+
+    bool valid = fread(magic, sizeof(magic), 1, file) == 1 &&
+                 fread(&size, sizeof(size), 1, file) == 1 &&
+                 fread(&mtime, sizeof(mtime), 1, file) == 1 &&
+                 fread(&frames, sizeof(frames), 1, file) == 1 &&
+                 memcmp(magic, kIndexMagic, sizeof(magic)) == 0 &&
+                 size == size_ && mtime == mtime_;
+
+    if (valid) {
+        offsets_.resize(frames);
+        valid = frames == 0 || fread(&offsets_[0], sizeof(uint64_t), frames, file) == frames;
+    }
+
+    fclose(file);
+
+    if (!valid) offsets_.clear();
+
+    return valid;
+}
+
+void ImmMmapReader::SaveIndex(const std::string& path) {
+    // The cache is an optimization only, failing to write it is fine.
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == NULL) return;
+
+    uint64_t size = size_;
+    int64_t mtime = mtime_;
+    uint64_t frames = offsets_.size();
+
+    fwrite(kIndexMagic, sizeof(kIndexMagic), 1, file);
+    fwrite(&size, sizeof(size), 1, file);
+    fwrite(&mtime, sizeof(mtime), 1, file);
+    fwrite(&frames, sizeof(frames), 1, file);
+    if (frames) fwrite(&offsets_[0], sizeof(uint64_t), frames, file);
+
+    fclose(file);
+}
+
+ImmBlock* ImmMmapReader::NextFrames(int count) {
+    ImmBlock *ret = pool_.Acquire(count, false, true);
+
+    int done = 0;
+    while (done < count && frame_ < (int) offsets_.size()) {
+        const char *frame = data_ + offsets_[frame_];
+        const ImmHeader *header = (const ImmHeader*) frame;
+        int pxs = header->dlen;
+        const char *payload = frame + ImmHeader::header_size;
+
+        ret->index[done] = NULL;
+        if (compression_) {
+            // Frames are packed back to back, so the 32-bit indices are only
+            // 4-byte aligned when the previous frames happen to line up. 
+            if (((uintptr_t) payload % sizeof(int)) == 0) {
+                ret->index[done] = (int*) payload;
+            } else {
+                memcpy(ret->IndexBuffer(done, pxs), payload, pxs * sizeof(int));
+            }
+            payload += pxs * sizeof(int);
+        }
+
+        ret->value16[done] = (short*) payload;
+        ret->pixels_per_frame.push_back(pxs);
+
+        ret->clock[done] = header->elapsed;
+        ret->ticks[done] = header->corecotick;
+        done++;
+        frame_++;
+    }
+
+    ret->frames = done;
+
+    return ret;
+}
+
+void ImmMmapReader::SkipFrames(int count) {
+    frame_ = std::min(frame_ + count, (int) offsets_.size());
+}
+
+void ImmMmapReader::Reset() {
+    frame_ = 0;
+}
+
+int ImmMmapReader::Frames() {
+    return offsets_.size();
+}
+
+bool ImmMmapReader::compression() { return compression_; }
+
+} // namespace io
+} // namespace xpcs
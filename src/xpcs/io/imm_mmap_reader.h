@@ -0,0 +1,118 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#ifndef XPCS_IMM_MMAP_READER_H
+#define XPCS_IMM_MMAP_READER_H
+
+#include "imm_header.h"
+#include "reader.h"
+#include "block_pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace xpcs {
+namespace io {
+
+/**
+ * IMM reader on top of a read-only memory map of the file. The offset of 
+ * every frame is indexed once, optionally cached in a sidecar file next to
+ * the IMM file, so skipping frames is O(1). The 16-bit values are handed 
+ * out as views into the mapping (ImmBlock::value16) together with the 
+ * 32-bit pixel indices, nothing is widened to float. 
+ */
+class ImmMmapReader : public Reader {
+
+public:
+
+  ImmMmapReader(const std::string& filename, bool cache_index = false);
+   
+  ~ImmMmapReader();
+
+  bool compression();
+
+  ImmBlock* NextFrames(int count = 1);
+
+  void SkipFrames(int count = 1);
+
+  void Reset();
+
+  int Frames();
+
+private:
+
+  void BuildIndex();
+
+  bool LoadIndex(const std::string& path);
+
+  void SaveIndex(const std::string& path);
+
+  const char *data_;
+
+  size_t size_;
+
+  long mtime_;
+
+  int fd_;
+
+  // Byte offset of the header of every frame in the file. 
+  std::vector<uint64_t> offsets_;
+
+  int frame_;
+
+  bool compression_;
+
+  BlockPool pool_;
+};
+
+} //namespace io
+} //namespace xpcs
+
+#endif
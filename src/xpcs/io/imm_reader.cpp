@@ -72,12 +72,9 @@ ImmReader::~ImmReader() {
 }
 
 ImmBlock* ImmReader::NextFrames(int count) {
-    int **index = new int*[count];
-    float **value = new float*[count];
-    double *clock = new double[count];
-    double *ticks = new double[count];
-
-    std::vector<int> ppf;
+    // The 16-bit payload is handed out as is, the filters widen only the 
+    // pixels they keep. 
+    ImmBlock *ret = pool_.Acquire(count, false, true);
 
     int done = 0, pxs = 0;
     while (done < count) {
@@ -86,12 +83,9 @@ ImmBlock* ImmReader::NextFrames(int count) {
         pxs = header_->dlen;
         // printf("Buffer # = %ld, pxs = %d\n", header_->buffer_number, pxs);
 
-        index[done] = new int[pxs];
-        value[done] = new float[pxs];
-        short *tmpmem = new short[pxs];
-        
+        ret->index[done] = NULL;
         if (compression_) {
-            fread(index[done], pxs * 4, 1, file_);
+            fread(ret->IndexBuffer(done, pxs), pxs * 4, 1, file_);
         } 
         
         // else {
@@ -99,25 +93,14 @@ ImmBlock* ImmReader::NextFrames(int count) {
         //     //     index[done][i] = i;
         // }
 
-        fread(tmpmem, pxs * 2, 1, file_);
-        std::copy(tmpmem, tmpmem + pxs, value[done]);
-        delete [] tmpmem;
-        ppf.push_back(pxs);
+        fread(ret->Value16Buffer(done, pxs), pxs * 2, 1, file_);
+        ret->pixels_per_frame.push_back(pxs);
 
-        clock[done] = header_->elapsed;
-        ticks[done] = header_->corecotick;
+        ret->clock[done] = header_->elapsed;
+        ret->ticks[done] = header_->corecotick;
         done++;
     }
 
-    struct ImmBlock *ret = new ImmBlock;
-    ret->index = index;
-    ret->value = value;
-    ret->frames = count;
-    ret->pixels_per_frame = ppf;
-    ret->clock = clock;
-    ret->ticks = ticks;
-    ret->id = 0;
-
     return ret;
 }
 
@@ -51,6 +51,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "imm_header.h"
 #include "reader.h"
+#include "block_pool.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -89,6 +90,8 @@ private:
   float *data_;
 
   bool compression_;
+
+  BlockPool pool_;
 };
 
 } //namespace io
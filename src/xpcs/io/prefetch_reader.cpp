@@ -0,0 +1,203 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+#include "prefetch_reader.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+namespace xpcs {
+namespace io {
+
+PrefetchReader::PrefetchReader(Reader* reader, int frames, int block, int depth) :
+    reader_(reader), block_(std::max(block, 1)), depth_(std::max(depth, 1)), frames_(frames)
+{
+    ring_ = new ImmBlock*[depth_];
+    current_ = NULL;
+    offset_ = 0;
+
+    Start();
+}
+
+PrefetchReader::~PrefetchReader() {
+    Stop();
+    delete [] ring_;
+}
+
+void PrefetchReader::Start() {
+    head_ = 0;
+    count_ = 0;
+    done_ = false;
+    stop_ = false;
+
+    thread_ = std::thread(&PrefetchReader::Run, this);
+}
+
+void PrefetchReader::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    not_full_.notify_all();
+
+    if (thread_.joinable())
+        thread_.join();
+
+    while (count_ > 0) {
+        ring_[head_]->Release();
+        head_ = (head_ + 1) % depth_;
+        count_--;
+    }
+
+    if (current_) current_->Release();
+    current_ = NULL;
+    offset_ = 0;
+}
+
+void PrefetchReader::Run() {
+    int remaining = frames_;
+
+    while (remaining > 0) {
+        int n = std::min(block_, remaining);
+        ImmBlock* blk = reader_->NextFrames(n);
+        remaining -= n;
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return count_ < depth_ || stop_; });
+
+        if (stop_) {
+            blk->Release();
+            break;
+        }
+
+        ring_[(head_ + count_) % depth_] = blk;
+        count_++;
+        not_empty_.notify_one();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    not_empty_.notify_one();
+}
+
+ImmBlock* PrefetchReader::Pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return count_ > 0 || done_; });
+
+    if (count_ == 0) return NULL;
+
+    ImmBlock* blk = ring_[head_];
+    head_ = (head_ + 1) % depth_;
+    count_--;
+    not_full_.notify_one();
+
+    return blk;
+}
+
+ImmBlock* PrefetchReader::NextFrames(int count) {
+    ImmBlock *ret = NULL;
+    int done = 0;
+
+    while (done < count) {
+        if (!current_ || offset_ == current_->frames) {
+            if (current_) current_->Release();
+            current_ = Pop();
+            offset_ = 0;
+        }
+
+        // Past the prefetched range, read the remaining frames directly. 
+        ImmBlock* src = current_;
+        int from = offset_;
+        if (!src)
+            src = reader_->NextFrames(count - done);
+
+        // Blocks from one reader either all carry 16-bit views or all floats.
+        if (ret == NULL) {
+            ret = pool_.Acquire(count, src->value != NULL, src->value16 != NULL);
+            ret->id = src->id;
+        }
+
+        int n = std::min(count - done, src->frames - from);
+        for (int i = 0; i < n; i++, done++) {
+            ret->index[done] = src->index[from + i];
+            if (ret->value) ret->value[done] = src->value[from + i];
+            if (ret->value16) ret->value16[done] = src->value16[from + i];
+            ret->clock[done] = src->clock[from + i];
+            ret->ticks[done] = src->ticks[from + i];
+            ret->pixels_per_frame.push_back(src->pixels_per_frame[from + i]);
+        }
+        ret->Borrow(src);
+
+        if (!current_) {
+            src->Release();
+            break;
+        }
+
+        offset_ += n;
+    }
+
+    if (ret == NULL)
+        ret = pool_.Acquire(0, false, false);
+
+    ret->frames = done;
+
+    return ret;
+}
+
+void PrefetchReader::SkipFrames(int count) {
+    NextFrames(count)->Release();
+}
+
+void PrefetchReader::Reset() {
+    Stop();
+    reader_->Reset();
+    Start();
+}
+
+bool PrefetchReader::compression() { return reader_->compression(); }
+
+} // namespace io
+} // namespace xpcs
@@ -0,0 +1,122 @@
+/**
+
+Copyright (c) 2016, UChicago Argonne, LLC. All rights reserved.
+
+Copyright 2016. UChicago Argonne, LLC. This software was produced 
+under U.S. Government contract DE-AC02-06CH11357 for Argonne National 
+Laboratory (ANL), which is operated by UChicago Argonne, LLC for the 
+U.S. Department of Energy. The U.S. Government has rights to use, 
+reproduce, and distribute this software.  NEITHER THE GOVERNMENT NOR 
+UChicago Argonne, LLC MAKES ANY WARRANTY, EXPRESS OR IMPLIED, OR a
+ASSUMES ANY LIABILITY FOR THE USE OF THIS SOFTWARE.  If software is 
+modified to produce derivative works, such modified software should 
+be clearly marked, so as not to confuse it with the version available 
+from ANL.
+
+Additionally, redistribution and use in source and binary forms, with 
+or without modification, are permitted provided that the following 
+conditions are met:
+
+    * Redistributions of source code must retain the above copyright 
+      notice, this list of conditions and the following disclaimer. 
+
+    * Redistributions in binary form must reproduce the above copyright 
+      notice, this list of conditions and the following disclaimer in 
+      the documentation and/or other materials provided with the 
+      distribution. 
+
+    * Neither the name of UChicago Argonne, LLC, Argonne National 
+      Laboratory, ANL, the U.S. Government, nor the names of its 
+      contributors may be used to endorse or promote products derived 
+      from this software without specific prior written permission. 
+
+THIS SOFTWARE IS PROVIDED BY UChicago Argonne, LLC AND CONTRIBUTORS 
+"AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS 
+FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL UChicago 
+Argonne, LLC OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, 
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, 
+BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; 
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER 
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT 
+LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN 
+ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+POSSIBILITY OF SUCH DAMAGE.
+
+**/
+
+#ifndef XPCS_PREFETCH_READER_H
+#define XPCS_PREFETCH_READER_H
+
+#include "reader.h"
+#include "block_pool.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace xpcs {
+namespace io {
+
+/**
+ * Reads frames ahead of the consumer on a background thread. The wrapped 
+ * reader is asked for blocks of `block` frames which are kept in a bounded
+ * ring of `depth` blocks, so disk latency overlaps with the filtering. Only
+ * `frames` frames are read ahead, the rest is read on demand. 
+ */
+class PrefetchReader : public Reader {
+
+public:
+
+  PrefetchReader(Reader* reader, int frames, int block = 16, int depth = 4);
+   
+  ~PrefetchReader();
+
+  bool compression();
+
+  ImmBlock* NextFrames(int count = 1);
+
+  void SkipFrames(int count = 1);
+
+  void Reset();
+
+private:
+
+  void Start();
+
+  void Stop();
+
+  void Run();
+
+  // Blocks until a prefetched block is available, NULL after the last one. 
+  ImmBlock* Pop();
+
+  Reader* reader_;
+
+  int block_;
+  int depth_;
+  int frames_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::condition_variable not_full_;
+
+  ImmBlock** ring_;
+  int head_;
+  int count_;
+  bool done_;
+  bool stop_;
+
+  // Block being handed out to the consumer and the next frame in it. 
+  ImmBlock* current_;
+  int offset_;
+
+  // Blocks handed out, they borrow the frames of the prefetched blocks. 
+  BlockPool pool_;
+};
+
+} //namespace io
+} //namespace xpcs
+
+#endif
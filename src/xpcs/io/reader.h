@@ -50,18 +50,59 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include <vector>
 #include <string>
+#include <atomic>
 
 namespace xpcs {
 namespace io {  
 
+class BlockPool;
+
+/**
+ * Frames handed out by a reader. Blocks come from the BlockPool of the 
+ * reader and go back to it with Release() once the consumer is done, the
+ * pointer arrays and frame buffers are reused by the next block. 
+ */
 struct ImmBlock {
   int** index;
   float** value;
+  // 16-bit values when the reader hands out the raw detector data (value 
+  // is NULL then). Filters widen only the pixels they keep. 
+  short** value16;
   int frames;
   int id;
   std::vector<int> pixels_per_frame;
   double* clock;
   double* ticks;
+
+  // Buffer of the block for `pixels` values of frame `frame`, it is also 
+  // stored in index[frame] or value[frame]. 
+  int* IndexBuffer(int frame, int pixels);
+
+  float* ValueBuffer(int frame, int pixels);
+
+  short* Value16Buffer(int frame, int pixels);
+
+  // Keeps `source` alive as long as this block has views into its frames.
+  void Borrow(ImmBlock* source);
+
+  // Hands the block back to its pool when nothing borrows it any more. 
+  void Release();
+
+  // Storage behind the pointers above. It only grows and is kept when the 
+  // block is recycled, so refilling a block allocates nothing once it has
+  // seen frames of the size. 
+  std::vector<int*> index_ptr;
+  std::vector<float*> value_ptr;
+  std::vector<short*> value16_ptr;
+  std::vector<double> clock_buf;
+  std::vector<double> ticks_buf;
+  std::vector<std::vector<int> > index_buf;
+  std::vector<std::vector<float> > value_buf;
+  std::vector<std::vector<short> > value16_buf;
+
+  std::vector<ImmBlock*> sources;
+  std::atomic<int> refs;
+  BlockPool* pool;
 };
 
 
@@ -77,6 +118,7 @@ public:
 
   virtual  bool compression() = 0;
   
+  // The caller releases the block when it is done with the frames. 
   virtual ImmBlock* NextFrames(int count = 1) = 0;
 
   virtual void SkipFrames(int count = 1) = 0;
@@ -50,132 +50,249 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <iostream>
 #include <vector>
 #include <iterator>
+#include <algorithm>
 
 #include "xpcs/configuration.h"
 
 namespace xpcs {
 namespace io {
 
-UfxcReader::UfxcReader(const std::string& filename) {
+// Words read from the file at a time, and decoded by one thread at a time. 
+static const size_t kUfxcChunkWords = 1 << 20;
+static const size_t kUfxcDecodeWords = 1 << 14;
+
+// Words begin .. end-1 of a chunk, all of one frame. They are decoded into 
+// the frame's arrays starting at offset. 
+struct UfxcRun {
+    int frame;
+    size_t begin;
+    size_t end;
+    size_t offset;
+    int *index;
+    float *value;
+};
+
+UfxcReader::UfxcReader(const std::string& filename, int reorder_frames) :
+    reorder_frames_(std::max(reorder_frames, 1))
+{
+    chunk_ = new uint[kUfxcChunkWords];
     file_ = fopen(filename.c_str(), "rb");
-    if (file_ == NULL) return ; //TODO handle error
 
-    std::vector<uint> data;
-
-    uint buffer[4096];
-    size_t read = fread(&buffer, sizeof(uint), 4096, file_);
-    while (read) {
-        for (int i = 0; i < read; i++) {
-            data.push_back(buffer[i]);
-        }
-        read = fread(&buffer, sizeof(uint), 4096, file_);
-    }
-
-    auto it = data.begin();
-    uint value = *it >> 21;
-    uint f0 = value;
-    int counter = 0;
-    int idx = 1;
-    data_frames_[value - f0] = std::vector<uint>();
-    data_frames_[value-f0].push_back(*it);
-
-    ++it;
-    int bf = 0;
-    int ff = 0; // frame number
-    int tmp_count = 0;
-    for(; it != data.end(); ++it) {
-        int diff = (*it >> 21) - value;
-        if (diff < -2000) {
-            bf += 2048;
-        } else if (diff > 2000) {
-            bf -= 2048;
-        } 
-        ff = (*it >> 21) + bf - f0;
-        if (data_frames_.find(ff) == data_frames_.end()) { 
-            data_frames_[ff] = std::vector<uint>();
-	}
-        data_frames_[ff].push_back(*it);
-        value = *it >> 21;
-    }
-   
-    last_frame_index = 0;
+    Reset();
 
     xpcs::Configuration *conf = xpcs::Configuration::instance();
     frame_width_ = conf->getFrameWidth();
     frame_height_ = conf->getFrameHeight();
 
-    printf("frame widht %d, frame height %d\n", frame_width_, frame_height_);
+    spdlog::get("console")->debug("UFXC: frame width {}, frame height {}", frame_width_, frame_height_);
 }
 
 UfxcReader::~UfxcReader() {
+    if (file_) fclose(file_);
+    delete [] chunk_;
 }
 
-ImmBlock* UfxcReader::NextFrames(int count) {
-    int **index = new int*[count];
-    float **value = new float*[count];
-    double *clock = new double[count];
-    double *ticks = new double[count];
+bool UfxcReader::Decode() {
+    size_t read = file_ ? fread(chunk_, sizeof(uint), kUfxcChunkWords, file_) : 0;
+    if (!read) {
+        eof_ = true;
+        return false;
+    }
+
+    // First pass, the words where the frame counter changes. 
+    std::vector<size_t> bounds;
+    bounds.push_back(0);
+    for (size_t i = 1; i < read; i++) {
+        if ((chunk_[i] ^ chunk_[i - 1]) >> 21)
+            bounds.push_back(i);
+    }
+    bounds.push_back(read);
 
-    std::vector<int> ppf;
+    std::vector<UfxcRun> runs;
+    for (size_t b = 0; b + 1 < bounds.size(); b++) {
+        uint value = chunk_[bounds[b]] >> 21;
 
+        if (!started_) {
+            first_counter_ = value;
+            last_counter_ = value;
+            started_ = true;
+        }
 
-    int done = 0, pxs = 0;
+        // The 11-bit counter wraps around every 2048 frames. 
+        int diff = value - last_counter_;
+        if (diff < -2000) {
+            wrap_ += 2048;
+        } else if (diff > 2000) {
+            wrap_ -= 2048;
+        }
+        last_counter_ = value;
+
+        int ff = value + wrap_ - first_counter_;
+        if (ff < last_frame_index) {
+            // Late words of skipped frames are expected, of the others not. 
+            if (ff < skip_begin_ || ff >= skip_end_) {
+                if (late_words_ == 0)
+                    spdlog::get("console")->error("UFXC: words of frame {} arrived after frame {}, more than the {} frames reorder window",
+                                                  ff, max_frame_, reorder_frames_);
+
+                late_words_ += bounds[b + 1] - bounds[b];
+                late_frames_ = std::max(late_frames_, max_frame_ - ff);
+            }
+            continue;
+        }
+
+        Frame& frame = ff < events_end_ ? events_ : data_frames_[ff];
+        max_frame_ = std::max(max_frame_, ff);
+
+        // Long runs are split so the decode spreads over the threads. 
+        for (size_t begin = bounds[b]; begin < bounds[b + 1]; begin += kUfxcDecodeWords) {
+            UfxcRun run;
+            run.frame = ff;
+            run.begin = begin;
+            run.end = std::min(bounds[b + 1], begin + kUfxcDecodeWords);
+            run.offset = frame.index.size();
+
+            frame.index.resize(run.offset + run.end - run.begin);
+            frame.value.resize(run.offset + run.end - run.begin);
+            runs.push_back(run);
+        }
+
+        if (ff < events_end_)
+            event_frames_.resize(events_.index.size(), ff - last_frame_index);
+    }
+
+    // The frames are sized now, so their arrays stay where they are. 
+    for (size_t r = 0; r < runs.size(); r++) {
+        int ff = runs[r].frame;
+        Frame& frame = ff < events_end_ ? events_ : data_frames_[ff];
+        runs[r].index = &frame.index[runs[r].offset];
+        runs[r].value = &frame.value[runs[r].offset];
+    }
+
+    // Second pass, decode the runs into their frames. 
+    int nruns = runs.size();
+    #pragma omp parallel for schedule(dynamic) if (nruns > 1)
+    for (int r = 0; r < nruns; r++) {
+        const UfxcRun& run = runs[r];
+
+        for (size_t i = run.begin; i < run.end; i++) {
+            uint pix = (chunk_[i] & 0x7fff);
+            int row = pix % frame_height_;
+            int col = pix / frame_height_;
+
+            run.index[i - run.begin] = row * frame_width_ + col;
+            run.value[i - run.begin] = (chunk_[i] >> 15) & 0x3;
+        }
+    }
+
+    return true;
+}
+
+ImmBlock* UfxcReader::NextFrames(int count) {
+    ImmBlock *ret = pool_.Acquire(count, true, false);
+    ret->id = 1;
+
+    int done = 0;
 
     while (done < count) {
-        clock[done] = last_frame_index;
-        ticks[done] = last_frame_index;
+        ret->clock[done] = last_frame_index;
+        ret->ticks[done] = last_frame_index;
 
-        if (data_frames_.find(last_frame_index) == data_frames_.end()) {
-            index[done] = new int[0];
-            value[done] = new float[0];
+        while (!eof_ && max_frame_ <= last_frame_index + reorder_frames_)
+            Decode();
 
-            ppf.push_back(0);
+        std::map<int, Frame>::iterator found = data_frames_.find(last_frame_index);
+        if (found == data_frames_.end()) {
+            ret->IndexBuffer(done, 0);
+            ret->ValueBuffer(done, 0);
+
+            ret->pixels_per_frame.push_back(0);
             last_frame_index++;
             done++;
             continue;
         }
 
-        std::vector<uint> frame = data_frames_[last_frame_index];
-        index[done] = new int[frame.size()];
-        value[done] = new float[frame.size()];
-        ppf.push_back(frame.size());
+        Frame& frame = found->second;
+        int size = frame.index.size();
+        ret->pixels_per_frame.push_back(size);
 
-        int idx = 0;
-        for (auto& it : frame) {
-            uint pix = (it & 0x7fff);
-            int row = pix % frame_height_;
-            int col = pix / frame_height_;
+        std::copy(frame.index.begin(), frame.index.end(), ret->IndexBuffer(done, size));
+        std::copy(frame.value.begin(), frame.value.end(), ret->ValueBuffer(done, size));
 
-            float val = (it >> 15) & 0x3;
-            index[done][idx] = row * frame_width_ + col;
-            value[done][idx] = val;
-	        idx++;
-        }
+        data_frames_.erase(found);
         done++;
         last_frame_index++;
     }
    
-    ImmBlock *ret = new ImmBlock;
-    ret->index = index;
-    ret->value = value;
-    ret->frames = count;
-    ret->pixels_per_frame = ppf;
-    ret->clock = clock;
-    ret->ticks = ticks;
-    ret->id = 1;
-
     return ret;
 }
 
+long UfxcReader::NextEvents(int frames, int *first, const int **frame, 
+                            const int **index, const float **value) {
+    events_.index.clear();
+    events_.value.clear();
+    event_frames_.clear();
+    events_end_ = last_frame_index + frames;
+
+    // Frames decoded ahead by NextFrames() go first. 
+    std::map<int, Frame>::iterator end = data_frames_.lower_bound(events_end_);
+    for (std::map<int, Frame>::iterator it = data_frames_.begin(); it != end; ++it) {
+        events_.index.insert(events_.index.end(), it->second.index.begin(), it->second.index.end());
+        events_.value.insert(events_.value.end(), it->second.value.begin(), it->second.value.end());
+        event_frames_.resize(events_.index.size(), it->first - last_frame_index);
+    }
+    data_frames_.erase(data_frames_.begin(), end);
+
+    // Same rule as NextFrames(), for the last frame of the range. 
+    while (!eof_ && max_frame_ < events_end_ + reorder_frames_)
+        Decode();
+
+    *first = last_frame_index;
+    *frame = event_frames_.empty() ? NULL : &event_frames_[0];
+    *index = events_.index.empty() ? NULL : &events_.index[0];
+    *value = events_.value.empty() ? NULL : &events_.value[0];
+
+    last_frame_index = events_end_;
+    events_end_ = 0;
+
+    return events_.index.size();
+}
+
 void UfxcReader::SkipFrames(int count) {
-    int done = 0;
+    if (count <= 0) return;
+
+    skip_begin_ = last_frame_index;
+    skip_end_ = last_frame_index + count;
+    last_frame_index = skip_end_;
+
+    // Frames that are decoded already are dropped, the words of the others 
+    // are dropped as they are decoded. 
+    data_frames_.erase(data_frames_.begin(), data_frames_.lower_bound(last_frame_index));
 }
 
 void UfxcReader::Reset() {
-    rewind(file_);
+    if (file_) rewind(file_);
+
+    data_frames_.clear();
+    last_frame_index = 0;
+    started_ = false;
+    first_counter_ = 0;
+    last_counter_ = 0;
+    wrap_ = 0;
+    max_frame_ = -1;
+    eof_ = false;
+    late_words_ = 0;
+    late_frames_ = 0;
+    events_end_ = 0;
+    skip_begin_ = 0;
+    skip_end_ = 0;
 }
 
 bool UfxcReader::compression() { return true; }
 
+long UfxcReader::LateWords() { return late_words_; }
+
+int UfxcReader::LateFrames() { return late_frames_; }
+
 } // namespace io
 } // namespace xpcs
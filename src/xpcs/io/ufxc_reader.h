@@ -50,11 +50,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #define XPCS_UFXCHEADER_H
 
 #include "reader.h"
+#include "block_pool.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
-#include <unordered_map>
+#include <map>
 #include <vector>
 #include "spdlog/spdlog.h"
 
@@ -62,10 +63,23 @@ POSSIBILITY OF SUCH DAMAGE.
 namespace xpcs {
 namespace io {
 
+/**
+ * Streams UFXC photon-counting data. Every 32-bit word is one photon event
+ * with an 11-bit frame counter, the file is decoded a chunk at a time and a
+ * frame is handed out once a word of a frame reorder_frames later has been 
+ * decoded, so only a few frames are held in memory. The window has to cover
+ * how late the detector writes words of a frame. Words that still arrive 
+ * after their frame was handed out cannot be kept, they are counted and 
+ * reported by LateWords(). 
+ * 
+ * A chunk is decoded in two passes, a sequential scan for the words where 
+ * the frame counter changes and a parallel decode of the runs of words 
+ * in between into the pixel indices and values of their frames. 
+ */
 class UfxcReader : public Reader {
 
 public:
-  UfxcReader(const std::string& filename);
+  UfxcReader(const std::string& filename, int reorder_frames = 2);
    
   ~UfxcReader();
 
@@ -73,21 +87,80 @@ public:
 
   ImmBlock* NextFrames(int count = 1);
 
+  /**
+   * Hands out the next `frames` frames as one list of photon events, 
+   * decoded straight into it without building any frames. Sets first to 
+   * the number of the first frame and, for every event in file order, its 
+   * frame counted from first, its pixel index and its count. The arrays stay
+   * valid until the next call, the number of events is returned.
+   */
+  long NextEvents(int frames, int *first, const int **frame, 
+                  const int **index, const float **value);
+
   void SkipFrames(int count = 1);
 
   void Reset();
 
+  /**
+   * Words that arrived after their frame was handed out, they are not in 
+   * any frame. LateFrames() is the reorder window that would have kept them.
+   */
+  long LateWords();
+
+  int LateFrames();
+
 private:
-  
+
+  // Decodes the next chunk of the file, false at the end of the file. 
+  bool Decode();
+
   FILE *file_;
 
   int last_frame_index;
 
-  std::unordered_map<int, std::vector<uint> > data_frames_;
+  // Pixel indices and values of a decoded frame. 
+  struct Frame {
+    std::vector<int> index;
+    std::vector<float> value;
+  };
+
+  // Decoded frames that were not handed out yet. 
+  std::map<int, Frame> data_frames_;
+
+  // Events of the frames last_frame_index .. events_end_-1 while 
+  // NextEvents() decodes them, and the frame of every event. Frames from 
+  // events_end_ on are decoded into data_frames_ as usual. 
+  Frame events_;
+  std::vector<int> event_frames_;
+  int events_end_;
+
+  uint *chunk_;
+
+  // Frame counter of the first word and the last word, and the frames 
+  // added by the counter wrapping around since the first word. 
+  bool started_;
+  uint first_counter_;
+  uint last_counter_;
+  int wrap_;
+
+  int max_frame_;
+  bool eof_;
+
+  // Frames a frame is held until a later frame's word is decoded. 
+  int reorder_frames_;
+
+  long late_words_;
+  int late_frames_;
+
+  // Frames skipped by the last SkipFrames(), their late words are expected.
+  int skip_begin_;
+  int skip_end_;
 
   int frame_width_;
   int frame_height_;
 
+  BlockPool pool_;
+
 };
 
 } //namespace io
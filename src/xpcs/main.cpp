@@ -51,22 +51,29 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 #include <memory>
 #include <map>
+#include <algorithm>
 #include <vector>
 #include <iostream>
 
 #include <sys/stat.h>
+#include <omp.h>
 
 #include "hdf5.h"
 #include "gflags/gflags.h"
 #include "spdlog/spdlog.h"
 
 #include "corr.h"
+#include "corr_stream.h"
+#include "g2_normalizer.h"
 #include "xpcs/configuration.h"
 #include "h5_result.h"
+#include "h5_writer.h"
 #include "benchmark.h"
 #include "xpcs/io/reader.h"
 #include "xpcs/io/imm_reader.h"
 #include "xpcs/io/ufxc_reader.h"
+#include "xpcs/io/prefetch_reader.h"
+#include "xpcs/io/imm_mmap_reader.h"
 #include "xpcs/filter/filter.h"
 #include "xpcs/filter/sparse_filter.h"
 #include "xpcs/filter/dense_filter.h"
@@ -81,11 +88,28 @@ namespace spd = spdlog;
 DEFINE_bool(g2out, false, "Write intermediate output from G2 computation");
 DEFINE_bool(darkout, false, "Write dark average and std-data");
 DEFINE_bool(binary, false, "IF the file format is from photon counting detector.");
+DEFINE_int32(ufxc_reorder, 2, "Frames a UFXC frame is held for words that arrive after words of later frames. Must cover how late the detector writes words, the run fails if words arrive later");
+DEFINE_bool(events, false, "Filter photon counting data straight from its photon events instead of frame by frame. Needs --binary, ignores --prefetch");
 DEFINE_int32(frameout, false, "Number of post-processed frames to write out for debuggin.");
 DEFINE_string(imm, "", "The path to IMM file. By default the file specified in HDF5 metadata is used");
 DEFINE_string(inpath, "", "The path prefix to replace");
 DEFINE_string(outpath, "", "The path prefix to replace with");
 DEFINE_string(entry, "", "The metadata path in HDF5 file");
+DEFINE_bool(stream, false, "Compute the multi-tau G2 while the frames are being read");
+DEFINE_int32(prefetch, 0, "Number of frame blocks to read ahead on a background thread. 0 disables prefetching");
+DEFINE_int32(filter_batch, 0, "Number of read blocks filtered concurrently before they are appended in order, 0 for one per OpenMP thread. Each block holds stride * avg frames (or whichever is set)");
+DEFINE_int32(prefetch_block, 16, "Number of frames in each prefetched block");
+DEFINE_bool(mmap, false, "Memory-map the IMM file and hand out 16-bit frames without copying");
+DEFINE_bool(keep_data, false, "Coarsen multi-tau levels in scratch buffers and leave the filtered data intact");
+DEFINE_string(g2_kernel, "merge", "Multi-tau pair search, merge (linear merge-join) or scan (forward scan per nonzero)");
+DEFINE_bool(fused_g2, false, "Reduce G2, IP and IF into the q-bins while multi-tau runs instead of keeping them per pixel. Ignored with --g2out");
+DEFINE_string(dense_kernel, "auto", "Dense frame threshold kernel, auto (best the CPU supports), avx512, avx2 or scalar");
+DEFINE_string(twotime_kernel, "auto", "Two-time C2 kernel, sparse (nonzero outer products), dense (panel GEMM) or auto (by q-bin density)");
+DEFINE_bool(imm_index, false, "Cache the IMM frame offsets in a <imm>.idx file next to the IMM file");
+DEFINE_bool(async_write, true, "Keep the result file open and write the results on a background thread");
+DEFINE_int32(h5_deflate, 0, "Chunk and deflate the large result datasets at this zlib level (1-9), 0 keeps them contiguous");
+DEFINE_bool(h5_shuffle, true, "Shuffle the bytes of compressed result datasets before deflating them");
+DEFINE_int32(h5_scaleoffset, 0, "Store the two-time matrices lossy with this many decimal digits (scale-offset filter), 0 is lossless");
 
 int main(int argc, char** argv)
 {
@@ -143,6 +167,14 @@ int main(int argc, char** argv)
     console->info("File size {0} {1}bytes", suffix > 0 ? (float)st.st_size/ pow(1024.0, suffix) : st.st_size, prefix[suffix]);
   }
 
+  xpcs::H5Layout layout = { FLAGS_h5_deflate, FLAGS_h5_shuffle, FLAGS_h5_scaleoffset };
+  xpcs::H5Result::setLayout(layout);
+
+  // Results go through the writer from here on, the file is closed at the end.
+  std::unique_ptr<xpcs::H5Writer> writer;
+  if (FLAGS_async_write)
+    writer.reset(new xpcs::H5Writer(conf->getFilename()));
+
   int* dqmap = conf->getDQMap();
   int *sqmap = conf->getSQMap();
 
@@ -170,26 +202,50 @@ int main(int argc, char** argv)
   }
   return 0;*/
 
-  float* g2s = new float[pixels * delays_per_level.size()];
-  float* ips = new float[pixels * delays_per_level.size()];
-  float* ifs = new float[pixels * delays_per_level.size()];
+  // The fused path reduces every pixel into the static partitions as soon 
+  // as it is correlated and never needs the pixels x taus arrays. 
+  bool fused = FLAGS_fused_g2 && !FLAGS_g2out && !FLAGS_stream && !conf->IsTwoTime();
+
+  float* g2s = NULL;
+  float* ips = NULL;
+  float* ifs = NULL;
+
+  if (!fused) {
+    g2s = new float[pixels * delays_per_level.size()];
+    ips = new float[pixels * delays_per_level.size()];
+    ifs = new float[pixels * delays_per_level.size()];
 
-  for (int i = 0; i < (pixels * delays_per_level.size()); i++) {
-    g2s[i] = 0.0f;
-    ips[i] = 0.0f;
-    ifs[i] = 0.0f;
+    for (int i = 0; i < (pixels * delays_per_level.size()); i++) {
+      g2s[i] = 0.0f;
+      ips[i] = 0.0f;
+      ifs[i] = 0.0f;
+    }
   }
 
   xpcs::io::Reader *reader = NULL; 
+  xpcs::io::UfxcReader *ufxc = NULL;
 
   if (FLAGS_binary) {
     printf("Loading it as binary\n");
-    reader = new xpcs::io::UfxcReader(conf->getIMMFilePath().c_str());
+    ufxc = new xpcs::io::UfxcReader(conf->getIMMFilePath().c_str(), FLAGS_ufxc_reorder);
+    reader = ufxc;
+  } else if (FLAGS_mmap) {
+    reader = new xpcs::io::ImmMmapReader(conf->getIMMFilePath().c_str(), FLAGS_imm_index);
   } else {
     reader = new xpcs::io::ImmReader(conf->getIMMFilePath().c_str());
   }
 
   xpcs::filter::Filter *filter = NULL;
+  xpcs::CorrStream *stream = NULL;
+
+  // Frame-sum normalization and frame dumps need every frame before the 
+  // correlation starts, so they keep the batch multi-tau path. 
+  if (FLAGS_stream) {
+    if (conf->IsTwoTime() || conf->IsNormalizedByFramesum() || FLAGS_frameout > 0)
+      console->warn("Streaming multi-tau is not supported with this analysis, falling back to multiTau2");
+    else
+      stream = new xpcs::CorrStream(g2s, ips, ifs);
+  }
   
   xpcs::data_structure::DarkImage *dark_image = NULL;
   {
@@ -204,7 +260,11 @@ int main(int argc, char** argv)
 
       if (dark_s != dark_e) {
         struct xpcs::io::ImmBlock *data = reader->NextFrames(darks);
-        dark_image = new xpcs::data_structure::DarkImage(data->value, darks, pixels, conf->getFlatField());
+        if (data->value16)
+          dark_image = new xpcs::data_structure::DarkImage(data->value16, darks, pixels, conf->getFlatField());
+        else
+          dark_image = new xpcs::data_structure::DarkImage(data->value, darks, pixels, conf->getFlatField());
+        data->Release();
         r += darks;
       }
     }
@@ -214,13 +274,28 @@ int main(int argc, char** argv)
       r += (frameFrom - r);
     }
 
+    xpcs::filter::SparseFilter *sparse_filter = NULL;
     if (reader->compression()) {
-      filter = new xpcs::filter::SparseFilter();
+      sparse_filter = new xpcs::filter::SparseFilter();
+      filter = sparse_filter;
     }
     else {
-      filter = new xpcs::filter::DenseFilter(dark_image);
+      xpcs::filter::DenseKernel::Isa isa = xpcs::filter::DenseKernel::kAuto;
+      if (FLAGS_dense_kernel == "avx512")
+        isa = xpcs::filter::DenseKernel::kAvx512;
+      else if (FLAGS_dense_kernel == "avx2")
+        isa = xpcs::filter::DenseKernel::kAvx2;
+      else if (FLAGS_dense_kernel == "scalar")
+        isa = xpcs::filter::DenseKernel::kScalar;
+      else if (FLAGS_dense_kernel != "auto")
+        console->warn("Unknown dense kernel {}, using auto", FLAGS_dense_kernel);
+
+      filter = new xpcs::filter::DenseFilter(dark_image, isa);
     }
 
+    if (stream)
+      filter->Stream(stream);
+
     xpcs::filter::Stride stride;
     // xpcs::filter::Average average;
     // xpcs::filter::DenseAverage dense_average;
@@ -229,14 +304,43 @@ int main(int argc, char** argv)
     if (stride_factor > 1 && average_factor > 1)
       read_in_count = stride_factor * average_factor;
 
+    bool events = FLAGS_events && ufxc != NULL;
+
+    if (FLAGS_prefetch > 0 && !events) {
+      reader = new xpcs::io::PrefetchReader(reader, 
+                                            frames * read_in_count, 
+                                            FLAGS_prefetch_block, 
+                                            FLAGS_prefetch);
+    }
+
+    if (events)
+      sparse_filter->ApplyEvents(ufxc, frames, read_in_count);
+
+    int batch = FLAGS_filter_batch > 0 ? FLAGS_filter_batch : omp_get_max_threads();
+    std::vector<struct xpcs::io::ImmBlock*> blocks(batch);
+
     // The last frame outside the stride will be ignored. 
     int f = 0;
-    while (f < frames) {
-      struct xpcs::io::ImmBlock* data = reader->NextFrames(read_in_count);
-      filter->Apply(data);
-      f++;
+    while (f < frames && !events) {
+      int count = std::min(batch, frames - f);
+      for (int b = 0; b < count; b++)
+        blocks[b] = reader->NextFrames(read_in_count);
+
+      filter->Apply(&blocks[0], count);
+      f += count;
     }
 
+    if (ufxc != NULL && ufxc->LateWords() > 0) {
+      console->error("UFXC: {} words arrived after their frames were read, rerun with --ufxc_reorder {} or more",
+                     ufxc->LateWords(), ufxc->LateFrames());
+      return 1;
+    }
+
+    if (stream)
+      stream->Finish();
+
+    filter->Data()->Finalize();
+
     if (FLAGS_frameout > 0 && FLAGS_frameout < frames) {
       xpcs::data_structure::SparseData *data = filter->Data();
       int fcount = FLAGS_frameout;
@@ -250,10 +354,10 @@ int main(int argc, char** argv)
       for (int j = 0; j < pixels; j++) {
         if (!data->Exists(j)) continue;
 
-        xpcs::data_structure::Row *row = data->Pixel(j);
-        for (int x = 0; x < row->indxPtr.size(); x++) {
-          int f = row->indxPtr[x];
-          float v = row->valPtr[x];
+        xpcs::data_structure::Row row = data->Pixel(j);
+        for (int x = 0; x < row.size; x++) {
+          int f = row.indxPtr[x];
+          float v = row.valPtr[x];
 
           if (f >= fcount) break;
 
@@ -282,20 +386,19 @@ int main(int argc, char** argv)
     framesums_mean = sum_of_framesums / frames;
 
     xpcs::data_structure::SparseData *data = filter->Data();
-    for (int j = 0; j < pixels; j++) {
-      if (!data->Exists(j)) continue;
-
-      xpcs::data_structure::Row *row = data->Pixel(j);
-      for (int x = 0; x < row->indxPtr.size(); x++) {
-        int f = row->indxPtr[x];
-        row->valPtr[x] = row->valPtr[x] / (frames_sum[f+frames] / framesums_mean);
+    std::vector<int>& valid_pixels = data->ValidPixels();
+    for (int i = 0; i < valid_pixels.size(); i++) {
+      xpcs::data_structure::Row row = data->Pixel(valid_pixels[i]);
+      for (int x = 0; x < row.size; x++) {
+        int f = row.indxPtr[x];
+        row.valPtr[x] = row.valPtr[x] / (frames_sum[f+frames] / framesums_mean);
       }
     }
   }
 
     /*xpcs::data_structure::SparseData *data = filter->Data();
-  xpcs::data_structure::Row *arow = data->Pixel(1133);
-  printf("Value = %f\n", arow->valPtr[0]);*/
+  xpcs::data_structure::Row arow = data->Pixel(1133);
+  printf("Value = %f\n", arow.valPtr[0]);*/
   
   float* pixels_sum = filter->PixelsSum();
   for (int i = 0 ; i < pixels; i++) {
@@ -393,15 +496,38 @@ int main(int argc, char** argv)
   {
     if (conf->IsTwoTime()) {
       xpcs::Benchmark benchmark("Computing G2 TwoTimes");
-      xpcs::Corr::twotime(filter->Data());
+      xpcs::Corr::TwoTimeKernel kernel = xpcs::Corr::kTwoTimeAuto;
+      if (FLAGS_twotime_kernel == "sparse")
+        kernel = xpcs::Corr::kTwoTimeSparse;
+      else if (FLAGS_twotime_kernel == "dense")
+        kernel = xpcs::Corr::kTwoTimeDense;
+      else if (FLAGS_twotime_kernel != "auto")
+        console->warn("Unknown two-time kernel {}, using auto", FLAGS_twotime_kernel);
+
+      xpcs::Corr::twotime(filter->Data(), kernel);
     } else {
       xpcs::Benchmark benchmark("Computing G2 MultiTau");
-      xpcs::Corr::multiTau2(filter->Data(), g2s, ips, ifs);
-      {
+      xpcs::Corr::G2Kernel kernel = xpcs::Corr::kMergeKernel;
+      if (FLAGS_g2_kernel == "scan")
+        kernel = xpcs::Corr::kScanKernel;
+      else if (FLAGS_g2_kernel != "merge")
+        console->warn("Unknown G2 kernel {}, using merge", FLAGS_g2_kernel);
+
+      if (fused) {
+        xpcs::G2Normalizer normalizer(delays_per_level.size());
+        xpcs::Corr::multiTau2(filter->Data(), &normalizer, FLAGS_keep_data, kernel);
+
+        xpcs::Benchmark benchmark("Normalizing Data");
+        normalizer.Write();
+      } else {
+        if (!stream)
+          xpcs::Corr::multiTau2(filter->Data(), g2s, ips, ifs, FLAGS_keep_data, kernel);
+
         xpcs::Benchmark benchmark("Normalizing Data");
-        Eigen::MatrixXf G2s = Eigen::Map<Eigen::MatrixXf>(g2s, pixels, delays_per_level.size());
-        Eigen::MatrixXf IPs = Eigen::Map<Eigen::MatrixXf>(ips, pixels, delays_per_level.size());
-        Eigen::MatrixXf IFs = Eigen::Map<Eigen::MatrixXf>(ifs, pixels, delays_per_level.size());
+        // Views of the multi-tau buffers, normalizeG2s works on them in place.
+        Eigen::Map<Eigen::MatrixXf> G2s(g2s, pixels, delays_per_level.size());
+        Eigen::Map<Eigen::MatrixXf> IPs(ips, pixels, delays_per_level.size());
+        Eigen::Map<Eigen::MatrixXf> IFs(ifs, pixels, delays_per_level.size());
 
         xpcs::Corr::normalizeG2s(G2s, IPs, IFs);
 
@@ -411,7 +537,6 @@ int main(int argc, char** argv)
           xpcs::H5Result::write2DData(conf->getFilename(), conf->OutputPath(), "IP", pixels, delays_per_level.size(), ips);
           xpcs::H5Result::write2DData(conf->getFilename(), conf->OutputPath(), "IF", pixels, delays_per_level.size(), ifs);
         }
-
       }
     }
     
@@ -437,5 +562,10 @@ int main(int argc, char** argv)
                                   dark_std);
     }
   }
+
+  if (writer) {
+    xpcs::Benchmark b("Flushing results");
+    writer->Close();
+  }
 }
 